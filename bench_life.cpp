@@ -0,0 +1,701 @@
+#include <iostream>
+#include <random>
+#include <future>
+#include <functional>
+#include "miniwindow.h"
+#include "table2d.h"
+#include "life.h"
+#include "patterns.h"
+
+//Generations per second of the Game of Life engines and parallel schemes over a sweep of board sizes and on known patterns.
+
+//The scheme parallel_fill2 used before the thread pool: 4 new threads per call, a static split of the rows,
+//x in the outer loop and serial below 100 rows.
+template<typename T, typename F>
+void async_fill2(Table2D<T>& t, F&& f)
+{
+	static const int n_threads = 4;
+	if(t.h < 100){ for(int i=0; i<t.w; ++i){ for(int j=0; j<t.h; ++j){ t(i, j) = f(i, j); } } return; }
+
+	std::vector<std::future<void>> fs(n_threads);
+	int ilow = 0;
+	int idelta = t.h / n_threads;
+	int ihi = idelta;
+	for(int k=0; k<n_threads; ++k)
+	{
+		if(k == n_threads-1){ ihi = t.h; }
+		fs[k] = std::async(std::launch::async, [&t, &f](int lo, int hi)
+		{
+			for(int i=0; i<t.w; ++i){ for(int j=lo; j<hi; ++j){ t(i, j) = f(i, j); } }
+		}, ilow, ihi);
+		ilow = ihi;
+		ihi += idelta;
+	}
+	std::for_each(fs.begin(), fs.end(), [](auto& fut){ fut.get(); });
+}
+
+//The per cell rule of the demos, with the wrap-around on every neighbour.
+auto wrapped_rule(Table2D<char> const& t)
+{
+	return [&t](int x, int y)->char
+	{
+		auto w = t.w;
+		auto h = t.h;
+		auto c = t(x, y);
+		auto xp1 = x == w-1 ? 0   : x+1;
+		auto xm1 = x == 0   ? w-1 : x-1;
+		auto yp1 = y == h-1 ? 0   : y+1;
+		auto ym1 = y == 0   ? h-1 : y-1;
+		auto sum = t(xm1, ym1) + t(x, ym1) + t(xp1, ym1)
+		         + t(xm1, y  ) +             t(xp1, y  )
+		         + t(xm1, yp1) + t(x, yp1) + t(xp1, yp1);
+		if(c == 0 &&  sum == 3           ){ return 1; }
+		if(c == 1 && (sum < 2 || sum > 3)){ return 0; }
+		return c;
+	};
+}
+
+auto stencil_rule = [](auto const& n)->char
+{
+	char c = n(0, 0);
+	char sum = n(-1, -1) + n(0, -1) + n(1, -1)
+	         + n(-1,  0) +            n(1,  0)
+	         + n(-1,  1) + n(0,  1) + n(1,  1);
+	return (char)((sum == 3) | (c & (sum == 2)));
+};
+
+//The reference for rules other than B3/S23: live neighbours counted with the wrap-around on every cell. Dying
+//states of Generations rules count as dead and age by one per generation.
+auto reference_rule(Table2D<char> const& t, Rule const& rule)
+{
+	return [&t, rule](int x, int y)->char
+	{
+		int sum = 0;
+		for(int dy=-1; dy<=1; ++dy)
+		{
+			for(int dx=-1; dx<=1; ++dx)
+			{
+				if(dx == 0 && dy == 0){ continue; }
+				sum += t(((x + dx) % t.w + t.w) % t.w, ((y + dy) % t.h + t.h) % t.h) == 1;
+			}
+		}
+		const char c = t(x, y);
+		if(c == 0){ return (char)((rule.birth >> sum) & 1); }
+		if(c == 1){ return (char)(((rule.survive >> sum) & 1) ? 1 : (rule.states > 2 ? 2 : 0)); }
+		return (char)(c + 1 < rule.states ? c + 1 : 0);
+	};
+}
+
+//Advances t by n generations, step(dst, src) computes one into a second table.
+template<typename F>
+void generations(Table2D<char>& t, int n, F&& step)
+{
+	Table2D<char> u;
+	u.resize(t.w, t.h);
+	for(int i=0; i<n; ++i){ step(u, t); std::swap(t, u); }
+}
+
+//Runs step on a bit board holding the cells of t and copies the result back.
+template<typename B, typename F>
+void on_bits(Table2D<char>& t, F&& step)
+{
+	B board;
+	board.resize(t.w, t.h);
+	board.fill([&](int x, int y){ return t(x, y) != 0; });
+	step(board);
+	t.fill2([&](int x, int y)->char{ return board.get(x, y) ? 1 : 0; });
+}
+
+//A kernel under test: run(t, n, pool) advances the board in t by n generations on the torus.
+struct Engine
+{
+	std::string name;
+	int threads;    //0 for the pool it is given.
+	std::function<void(Table2D<char>&, int, ThreadPool&)> run;
+};
+
+std::vector<Engine> rule_engines(Rule const& rule)
+{
+	return
+	{
+		{"rule " + rule.str(), 1, [rule](Table2D<char>& t, int n, ThreadPool&)
+		{
+			generations(t, n, [&](Table2D<char>& d, Table2D<char> const& s){ rule.with_kernel([&](auto const& k){ d.stencil<1>(s, k); }); });
+		}},
+		{"pool rule " + rule.str(), 0, [rule](Table2D<char>& t, int n, ThreadPool& pool)
+		{
+			generations(t, n, [&](Table2D<char>& d, Table2D<char> const& s){ rule.with_kernel([&](auto const& k){ d.parallel_stencil<1>(pool, s, k); }); });
+		}},
+	};
+}
+
+//The kernel compiled for a rule known at compile time, through the static Rule::with_kernel.
+template<uint16_t B, uint16_t S, int C>
+std::vector<Engine> static_engines()
+{
+	const Rule rule{B, S, C, true};
+	return
+	{
+		{"static rule " + rule.str(), 0, [](Table2D<char>& t, int n, ThreadPool& pool)
+		{
+			generations(t, n, [&](Table2D<char>& d, Table2D<char> const& s){ Rule::with_kernel<B, S, C>([&](auto const& k){ d.parallel_stencil<1>(pool, s, k); }); });
+		}},
+	};
+}
+
+//Every B3/S23 engine on the torus.
+std::vector<Engine> life_engines()
+{
+	std::vector<Engine> e =
+	{
+		{"async fill2", 4, [](Table2D<char>& t, int n, ThreadPool&)
+		{
+			generations(t, n, [](Table2D<char>& d, Table2D<char> const& s){ async_fill2(d, wrapped_rule(s)); });
+		}},
+		{"pool fill2", 0, [](Table2D<char>& t, int n, ThreadPool& pool)
+		{
+			generations(t, n, [&](Table2D<char>& d, Table2D<char> const& s){ d.parallel_fill2(pool, wrapped_rule(s)); });
+		}},
+		{"stencil", 1, [](Table2D<char>& t, int n, ThreadPool&)
+		{
+			generations(t, n, [](Table2D<char>& d, Table2D<char> const& s){ d.stencil<1>(s, stencil_rule); });
+		}},
+		{"pool stencil", 0, [](Table2D<char>& t, int n, ThreadPool& pool)
+		{
+			generations(t, n, [&](Table2D<char>& d, Table2D<char> const& s){ d.parallel_stencil<1>(pool, s, stencil_rule); });
+		}},
+		{"bitlife", 1, [](Table2D<char>& t, int n, ThreadPool&)
+		{
+			on_bits<BitLife>(t, [&](BitLife& b){ for(int i=0; i<n; ++i){ b.step(); } });
+		}},
+		{"pool bitlife", 0, [](Table2D<char>& t, int n, ThreadPool& pool)
+		{
+			on_bits<BitLife>(t, [&](BitLife& b)
+			{
+				for(int i=0; i<n; ++i){ pool.parallel_chunks(b.h, 8, [&](int lo, int hi){ b.step_rows(lo, hi); }); b.swap(); }
+			});
+		}},
+		{"temporal 8", 1, [](Table2D<char>& t, int n, ThreadPool&)
+		{
+			on_bits<BitLife>(t, [&](BitLife& b){ b.depth = 8; b.step(n); });
+		}},
+		{"pool temporal 8", 0, [](Table2D<char>& t, int n, ThreadPool& pool)
+		{
+			on_bits<BitLife>(t, [&](BitLife& b){ b.depth = 8; b.band = 16; b.step(n, pool); });
+		}},
+		{"active bitlife", 1, [](Table2D<char>& t, int n, ThreadPool&)
+		{
+			on_bits<ActiveLife>(t, [&](ActiveLife& b){ for(int i=0; i<n; ++i){ b.step(); } });
+		}},
+		{"pool active", 0, [](Table2D<char>& t, int n, ThreadPool& pool)
+		{
+			on_bits<ActiveLife>(t, [&](ActiveLife& b){ for(int i=0; i<n; ++i){ b.step(pool); } });
+		}},
+	};
+	auto r = rule_engines(Rule::parse("B3/S23"));
+	e.insert(e.end(), r.begin(), r.end());
+	return e;
+}
+
+//Whether a board comes back unchanged from RLE and Macrocell files.
+bool check_patterns(Rule const& rule, int w, int h)
+{
+	std::mt19937 mt(w * 31 + h);
+	Table2D<char> t, u, v;
+	t.resize(w, h); v.resize(w, h);
+	t.fill1([&](int)->char{ return mt() % 3 == 0 ? (char)(1 + mt() % (rule.states - 1)) : 0; });
+	FILE* f = tmpfile();
+	if(!f || !save_rle(f, t, rule)){ return false; }
+	rewind(f);
+	PatternInfo info;
+	bool ok = load_rle(f, u, 0, 0, &info) && info.rule.str() == rule.str() && u.w == w && u.h == h && std::equal(t.data.begin(), t.data.end(), u.data.begin());
+	fclose(f);
+	if(ok && rule.states == 2)
+	{
+		f = tmpfile();
+		ok = f && save_macrocell(f, t, rule);
+		if(f){ rewind(f); }
+		ok = ok && load_macrocell(f, v, 0, 0) && std::equal(t.data.begin(), t.data.end(), v.data.begin());
+		if(f){ fclose(f); }
+	}
+	return ok;
+}
+
+//Calls f with stdout going nowhere, for files rejected on purpose by functions that print why. Keeps stdout
+//JSON-only for --json -.
+template<typename F>
+bool quietly(F&& f)
+{
+#ifdef _WIN32
+	return f();
+#else
+	fflush(stdout);
+	const int saved = dup(fileno(stdout)), null = open("/dev/null", O_WRONLY);
+	if(saved >= 0 && null >= 0){ dup2(null, fileno(stdout)); }
+	const bool r = f();
+	fflush(stdout);
+	if(saved >= 0 && null >= 0){ dup2(saved, fileno(stdout)); }
+	if(saved >= 0){ close(saved); }
+	if(null >= 0){ close(null); }
+	return r;
+#endif
+}
+
+//Whether a board comes back unchanged from a checkpoint through private and shared mappings, and whether files
+//that do not hold the board are refused.
+bool check_checkpoints(Rule const& rule, int w, int h)
+{
+	char const* tmp = getenv("TMPDIR");
+#ifdef _WIN32
+	if(!tmp){ tmp = getenv("TEMP"); }
+#endif
+	const std::string path = std::string(tmp ? tmp : ".") + "/miniwnd_bench_life.t2d";
+	std::mt19937 mt(w * 17 + h);
+	Table2D<char> t, next;
+	t.resize(w, h);
+	t.fill1([&](int)->char{ return (char)(mt() % (unsigned)rule.states); });
+	rule.with_kernel([&](auto const& k){ next.stencil<1>(t, k); });
+	auto same = [](Table2D<char> const& a, Table2D<char> const& b){ return a.w == b.w && a.h == b.h && std::equal(a.data.begin(), a.data.end(), b.data.begin()); };
+	//The cells in the file, read through a fresh private mapping.
+	auto stored = [&](Table2D<char> const& expected, uint64_t generation)
+	{
+		Checkpoint c;
+		Table2D<char> u;
+		const bool ok = c.open(path, Checkpoint::Private) && c.generation() == generation && c.attach(u) && same(u, expected);
+		u.detach();
+		return ok;
+	};
+
+	bool ok = save_checkpoint(path, t, 7) && stored(t, 7);
+	//Private: the board runs on in the copy-on-write mapping, the file keeps the saved generation.
+	{
+		Checkpoint c;
+		Table2D<char> u;
+		ok = ok && c.open(path, Checkpoint::Private) && c.attach(u);
+		if(ok){ std::copy(next.data.begin(), next.data.end(), u.data.begin()); }
+		ok = ok && same(u, next);
+		u.detach();
+	}
+	ok = ok && stored(t, 7);
+#ifndef _WIN32
+	//Shared: writes through one mapping are seen by another one at once and are in the file after sync.
+	{
+		Checkpoint a, b;
+		Table2D<char> u, v;
+		ok = ok && a.open(path, Checkpoint::Shared) && b.open(path, Checkpoint::Shared) && a.attach(u) && b.attach(v);
+		if(ok){ std::copy(next.data.begin(), next.data.end(), u.data.begin()); }
+		ok = ok && same(v, next) && a.sync(8) && b.generation() == 8;
+		u.detach(); v.detach();
+	}
+	ok = ok && stored(next, 8);
+#endif
+
+	//Refused: another cell type, a truncated file, a file that is not a checkpoint and one that does not exist.
+	ok = ok && quietly([&]
+	{
+		bool refused = true;
+		{
+			Checkpoint c;
+			Table2D<int> wide;
+			refused = c.open(path) && !c.attach(wide) && refused;
+		}
+		std::vector<char> bytes;
+		if(FILE* f = fopen(path.c_str(), "rb"))
+		{
+			bytes.resize(sizeof(CheckpointHeader) + t.size());
+			bytes.resize(fread(bytes.data(), 1, bytes.size(), f));
+			fclose(f);
+		}
+		auto rewrite = [&](size_t n)
+		{
+			FILE* f = fopen(path.c_str(), "wb");
+			if(!f){ return false; }
+			const bool written = fwrite(bytes.data(), 1, n, f) == n;
+			return (fclose(f) == 0) && written;
+		};
+		{
+			Checkpoint c;
+			Table2D<char> u;
+			refused = bytes.size() == sizeof(CheckpointHeader) + t.size() && rewrite(bytes.size() - 1) && c.open(path) && !c.attach(u) && refused;
+		}
+		{
+			Checkpoint c;
+			bytes[0] = 'X';
+			refused = rewrite(bytes.size()) && !c.open(path) && refused;
+		}
+		std::remove(path.c_str());
+		{
+			Checkpoint c;
+			refused = !c.open(path) && refused;
+		}
+		return refused;
+	});
+	std::remove(path.c_str());
+	return ok;
+}
+
+//Known patterns, 'O' is a live cell.
+struct Pattern
+{
+	std::string name;
+	std::vector<std::string> rows;
+
+	template<typename F>
+	void place(F&& set) const
+	{
+		for(int y=0; y<(int)rows.size(); ++y){ for(int x=0; x<(int)rows[y].size(); ++x){ if(rows[y][x] == 'O'){ set(x, y); } } }
+	}
+};
+
+const Pattern patterns[] =
+{
+	{"r-pentomino", {".OO", "OO.", ".O."}},
+	{"acorn",       {".O.....", "...O...", "OO..OOO"}},
+	{"gosper gun",  {"........................O...........",
+	                 "......................O.O...........",
+	                 "............OO......OO............OO",
+	                 "...........O...O....OO............OO",
+	                 "OO........O.....O...OO..............",
+	                 "OO........O...O.OO....O.O...........",
+	                 "..........O.....O.......O...........",
+	                 "...........O...O....................",
+	                 "............OO......................"}},
+};
+
+struct Result
+{
+	std::string engine, pattern;
+	int n, threads;            //n = 0 for unbounded boards
+	long generations;
+	double ns_per_generation;
+
+	double cells_per_s() const { return ns_per_generation > 0 ? (double)n * n / ns_per_generation * 1e9 : 0.0; }
+};
+
+//An engine against the reference after a number of generations from the same soup.
+struct Check
+{
+	std::string engine, reference;
+	int w, h, threads, generations;
+	bool equal;
+};
+
+struct Bench
+{
+	std::vector<Result> results;
+	std::vector<Check> checks;
+	double min_ms = 200.0;
+	FILE* log = stdout;    //The table, stderr when the JSON goes to stdout.
+	int width = 16;        //Of the engine column, as wide as the longest name in the table.
+
+	//Whether every engine gives the reference board after n generations from a soup on a w x h torus.
+	bool check(std::vector<Engine> const& engines, std::vector<ThreadPool*> const& pools, Rule const& rule, int w, int h, int n)
+	{
+		std::mt19937 mt(w * 31 + h);
+		Table2D<char> start;
+		start.resize(w, h);
+		start.fill1([&](int)->char{ return (char)(mt() % (unsigned)rule.states); });
+		Table2D<char> expected = start;
+		const bool life = rule.str() == "B3/S23";
+		generations(expected, n, [&](Table2D<char>& d, Table2D<char> const& s)
+		{
+			if(life){ d.fill2(wrapped_rule(s)); }
+			else{ d.fill2(reference_rule(s, rule)); }
+		});
+		bool ok = true;
+		for(auto const& e : engines)
+		{
+			for(auto p : pools)
+			{
+				Table2D<char> t = start;
+				e.run(t, n, *p);
+				const bool equal = std::equal(t.data.begin(), t.data.end(), expected.data.begin());
+				checks.push_back({e.name, life ? "fill2" : "reference " + rule.str(), w, h, e.threads ? e.threads : p->size(), n, equal});
+				if(!equal){ fprintf(log, "%s on %i threads differs from the reference on %i x %i after %i generations\n", e.name.c_str(), p->size(), w, h, n); ok = false; }
+				//Pools only matter to the engines that use them.
+				if(e.threads){ break; }
+			}
+		}
+		return ok;
+	}
+
+	template<typename F>
+	void run(std::string const& engine, int n, int threads, F&& step){ run(engine, "random", n, threads, 1, step); }
+
+	//step advances gens_per_step generations per call.
+	template<typename F>
+	void run(std::string const& engine, std::string const& pattern, int n, int threads, long gens_per_step, F&& step)
+	{
+		step();//warm-up
+		long gens = 0;
+		double ms = 0.0;
+		for(long batch = 1; ms < min_ms; batch *= 2)
+		{
+			auto t0 = std::chrono::high_resolution_clock::now();
+			for(long i=0; i<batch; ++i){ step(); }
+			auto t1 = std::chrono::high_resolution_clock::now();
+			ms += (static_cast<std::chrono::duration<double, std::milli>>(t1-t0)).count();
+			gens += batch * gens_per_step;
+		}
+		Result res{engine, pattern, n, threads, gens, ms * 1e6 / gens};
+		fprintf(log, "%-*s %-12s %6i x %-6i %3i  %14.3f %14.1f %10.1f\n", width, engine.c_str(), pattern.c_str(), n, n, threads, res.ns_per_generation, 1e9 / res.ns_per_generation, res.cells_per_s() / 1e6);
+		results.push_back(res);
+	}
+
+	//Whether the unbounded engines agree with the reference on a torus large enough that the pattern never wraps.
+	bool check_unbounded(Pattern const& p, int n, int gens)
+	{
+		Table2D<char> expected;
+		expected.resize(n, n);
+		p.place([&](int x, int y){ expected(n/2 + x, n/2 + y) = 1; });
+		generations(expected, gens, [&](Table2D<char>& d, Table2D<char> const& s){ d.fill2(wrapped_rule(s)); });
+		long population = 0;
+		for(char c : expected.data){ population += c; }
+
+		SparseLife sparse;
+		HashLife hash;
+		hash.stepLog2 = 0;
+		p.place([&](int x, int y){ sparse.set(x, y, true); hash.set(x, y, true); });
+		for(int i=0; i<gens; ++i){ sparse.step(); hash.step(); }
+		//The board read back from an RLE file has to be in the same place.
+		SparseLife loaded;
+		FILE* f = tmpfile();
+		bool rle_equal = f && save_rle(f, sparse);
+		if(f){ rewind(f); }
+		rle_equal = rle_equal && load_rle(f, loaded) && loaded.population() == population;
+		if(f){ fclose(f); }
+		bool sparse_equal = sparse.population() == population, hash_equal = (long)hash.population() == population;
+		for(int y=0; y<n; ++y)
+		{
+			for(int x=0; x<n; ++x)
+			{
+				const bool live = expected(x, y) != 0;
+				sparse_equal = sparse_equal && sparse.get(x - n/2, y - n/2) == live;
+				hash_equal = hash_equal && hash.get(x - n/2, y - n/2) == live;
+				rle_equal = rle_equal && loaded.get(x - n/2, y - n/2) == live;
+			}
+		}
+		checks.push_back({"sparse " + p.name, "fill2", n, n, 1, gens, sparse_equal});
+		checks.push_back({"hashlife " + p.name, "fill2", n, n, 1, gens, hash_equal});
+		checks.push_back({"sparse rle " + p.name, "fill2", n, n, 1, gens, rle_equal});
+		if(!sparse_equal){ fprintf(log, "sparse differs from the reference on %s after %i generations\n", p.name.c_str(), gens); }
+		if(!hash_equal){ fprintf(log, "hashlife differs from the reference on %s after %i generations\n", p.name.c_str(), gens); }
+		if(!rle_equal){ fprintf(log, "sparse %s after %i generations does not survive a round trip through RLE\n", p.name.c_str(), gens); }
+		return sparse_equal && hash_equal && rle_equal;
+	}
+
+	//To stdout for "-".
+	bool write(std::string const& json) const
+	{
+		if(json == "-"){ write_json(stdout); return true; }
+		if(json.empty()){ return true; }
+		FILE* f = fopen(json.c_str(), "w");
+		if(!f){ printf("Cannot open %s\n", json.c_str()); return false; }
+		write_json(f);
+		fclose(f);
+		return true;
+	}
+
+	void write_json(FILE* f) const
+	{
+		fprintf(f, "{\n  \"benchmark\": \"miniwnd_bench_life\",\n  \"results\": [\n");
+		for(size_t i=0; i<results.size(); ++i)
+		{
+			auto const& res = results[i];
+			fprintf(f, "    {\"engine\": \"%s\", \"pattern\": \"%s\", \"width\": %i, \"height\": %i, \"threads\": %i, \"generations\": %ld, "
+			           "\"ns_per_generation\": %.3f, \"cells_per_s\": %.1f}%s\n",
+				res.engine.c_str(), res.pattern.c_str(), res.n, res.n, res.threads, res.generations, res.ns_per_generation, res.cells_per_s(), i+1 < results.size() ? "," : "");
+		}
+		fprintf(f, "  ],\n  \"conformance\": [\n");
+		for(size_t i=0; i<checks.size(); ++i)
+		{
+			auto const& c = checks[i];
+			fprintf(f, "    {\"engine\": \"%s\", \"reference\": \"%s\", \"width\": %i, \"height\": %i, \"threads\": %i, \"generations\": %i, \"equal\": %s}%s\n",
+				c.engine.c_str(), c.reference.c_str(), c.w, c.h, c.threads, c.generations, c.equal ? "true" : "false", i+1 < checks.size() ? "," : "");
+		}
+		fprintf(f, "  ]\n}\n");
+	}
+};
+
+int main(int argc, char** argv)
+{
+	Bench b;
+	std::string json;
+	int gens = 64;
+	std::vector<int> thread_counts;
+	for(int i=1; i<argc; ++i)
+	{
+		std::string a = argv[i];
+		if     (a == "--json" && i+1 < argc){ json = argv[++i]; }
+		else if(a == "--quick"){ b.min_ms = 20.0; gens = 16; }
+		else if(a == "--generations" && i+1 < argc){ gens = std::max(1, atoi(argv[++i])); }
+		else if(a == "--threads" && i+1 < argc)
+		{
+			for(char const* p = argv[++i]; *p; ){ thread_counts.push_back(std::max(1, (int)strtol(p, (char**)&p, 10))); if(*p == ','){ ++p; } else if(*p){ break; } }
+		}
+		else{ printf("Usage: %s [--json <file>|-] [--quick] [--generations <n>] [--threads <n,n,...>]\n", argv[0]); return 1; }
+	}
+	FILE* out = json == "-" ? stderr : stdout;
+	b.log = out;
+
+	//Pools of 1, 2, 4, ... threads up to one per hardware thread unless given.
+	const int hardware = (int)std::max(1u, std::thread::hardware_concurrency());
+	if(thread_counts.empty())
+	{
+		for(int t=1; t<hardware; t*=2){ thread_counts.push_back(t); }
+		thread_counts.push_back(hardware);
+	}
+	std::vector<std::unique_ptr<ThreadPool>> owned;
+	std::vector<ThreadPool*> pools;
+	for(int t : thread_counts){ owned.emplace_back(new ThreadPool(t)); pools.push_back(owned.back().get()); }
+
+	//The pinned pools without stealing keep every band on its thread, they are checked as well.
+	ThreadPool pinned(hardware, ThreadPool::Nodes);
+	pinned.stealing = false;
+	std::vector<ThreadPool*> checked = pools;
+	checked.push_back(&pinned);
+
+	//Every kernel against the reference first, a fast kernel is only worth timing if it is right.
+	//A generic rule runs on the run time kernel, the others on kernels compiled for them; the generic ones are also
+	//compiled through the static with_kernel.
+	constexpr Rule conway = Rule::parse("B3/S23"), brain = Rule::parse("B2/S/C3"), generic = Rule::parse("B34/S34"), generic_gen = Rule::parse("B34/S34/C5");
+	const Rule highlife = Rule::parse("B36/S23"), daynight = Rule::parse("B3678/S34678"), seeds = Rule::parse("B2/S"), starwars = Rule::parse("B2/S345/C4");
+	bool ok = true;
+	for(char const* bad : {"", "B3/23", "B3S23/2", "B3/S23/", "B3/S2/S3", "B3B6/S23", "B2/S/C3/C4"})
+	{
+		if(Rule::parse(bad).valid){ fprintf(out, "The rule string \"%s\" parses\n", bad); ok = false; }
+	}
+	for(auto const& c : std::vector<std::array<int, 2>>{{1, 1}, {37, 5}, {64, 64}, {200, 130}, {1000, 700}})
+	{
+		ok = b.check(life_engines(), checked, conway, c[0], c[1], gens) && ok;
+		for(auto const& r : {brain, highlife, daynight, seeds, starwars, generic, generic_gen}){ ok = b.check(rule_engines(r), checked, r, c[0], c[1], gens) && ok; }
+		ok = b.check(static_engines<generic.birth, generic.survive, generic.states>(), checked, generic, c[0], c[1], gens) && ok;
+		ok = b.check(static_engines<generic_gen.birth, generic_gen.survive, generic_gen.states>(), checked, generic_gen, c[0], c[1], gens) && ok;
+	}
+	for(auto const& p : patterns){ ok = b.check_unbounded(p, 256, gens) && ok; }
+	for(auto const& r : {conway, brain, generic_gen})
+	{
+		if(!check_patterns(r, 173, 91)){ fprintf(out, "%s boards do not survive a round trip through pattern files\n", r.str().c_str()); ok = false; }
+		if(!check_checkpoints(r, 173, 91)){ fprintf(out, "%s boards do not survive a round trip through checkpoints\n", r.str().c_str()); ok = false; }
+	}
+	if(!ok){ b.write(json); return 1; }
+	fprintf(out, "%zu conformance checks passed, %i generations\n", b.checks.size(), gens);
+
+	//Every rule gets a pool rule row.
+	const Rule timed[] = {conway, brain, generic, generic_gen};
+	for(auto const& r : timed){ b.width = std::max(b.width, (int)("pool rule " + r.str()).size()); }
+	fprintf(out, "%-*s %-12s %15s %3s  %14s %14s %10s\n", b.width, "engine", "pattern", "board", "thr", "ns/generation", "generations/s", "Mcells/s");
+
+	auto& pool = *pools.back();
+	const int threads = pool.size();
+
+	for(int n : {64, 256, 1024, 4096})
+	{
+		std::mt19937 mt(42);
+		std::array<Table2D<char>, 2> t;
+		t[0].resize(n, n); t[1].resize(n, n);
+		t[0].fill1([&](int)->char{ return mt() & 1; });
+		int idx = 0;
+
+		b.run("async fill2", n, 4,       [&]{ async_fill2(t[1-idx], wrapped_rule(t[idx])); idx = 1 - idx; });
+		b.run("stencil", n, 1,           [&]{ t[1-idx].stencil<1>(t[idx], stencil_rule); idx = 1 - idx; });
+		b.run("rule " + conway.str(), n, 1, [&]{ conway.with_kernel([&](auto const& k){ t[1-idx].stencil<1>(t[idx], k); }); idx = 1 - idx; });
+		for(auto p : pools)
+		{
+			b.run("pool fill2", n, p->size(),   [&]{ t[1-idx].parallel_fill2(*p, wrapped_rule(t[idx])); idx = 1 - idx; });
+			b.run("pool stencil", n, p->size(), [&]{ t[1-idx].parallel_stencil<1>(*p, t[idx], stencil_rule); idx = 1 - idx; });
+			for(auto const& r : timed)
+			{
+				b.run("pool rule " + r.str(), n, p->size(), [&]{ r.with_kernel([&](auto const& k){ t[1-idx].parallel_stencil<1>(*p, t[idx], k); }); idx = 1 - idx; });
+			}
+		}
+
+		BitLife board;
+		board.resize(n, n);
+		board.fill([&](int, int){ return (mt() & 1) != 0; });
+		b.run("bitlife", n, 1,           [&]{ board.step(); });
+		b.run("temporal 8", "random", n, 1, 8, [&]{ board.step(8); });
+		for(auto p : pools)
+		{
+			b.run("pool bitlife", n, p->size(), [&]{ p->parallel_chunks(n, std::max(1, 262144 / std::max(board.words, 1)), [&](int lo, int hi){ board.step_rows(lo, hi); }); board.swap(); });
+			b.run("pool temporal 8", "random", n, p->size(), 8, [&]{ board.step(8, *p); });
+		}
+	}
+
+	//Memory placement: the tables zero-filled by one thread against first touch by the threads of the pool, which
+	//with pinning and without stealing keep their rows on their own NUMA node. Thread 0 is this thread, unpinned.
+	{
+		const int n = 4096;
+		std::mt19937 mt(42);
+		std::array<Table2D<char>, 2> t;
+		t[0].resize(n, n); t[1].resize(n, n);
+		t[0].fill1([&](int)->char{ return mt() & 1; });
+		int idx = 0;
+		b.run("numa stencil", "one touch", n, threads, 1, [&]{ t[1-idx].parallel_stencil<1>(pool, t[idx], stencil_rule); idx = 1 - idx; });
+		const std::pair<ThreadPool::Pinning, char const*> modes[] = {{ThreadPool::Unpinned, "float"}, {ThreadPool::Nodes, "nodes"}, {ThreadPool::Cores, "cores"}};
+		for(auto const& m : modes)
+		{
+			for(bool steal : {true, false})
+			{
+				ThreadPool p(threads, m.first);
+				p.stealing = steal;
+				std::array<Table2D<char>, 2> u;
+				u[0].resize(p, n, n); u[1].resize(p, n, n);
+				u[0].parallel_rows(p, [&](int lo, int hi){ std::copy(&t[0](0, lo), &t[0](0, lo) + (size_t)(hi - lo) * n, &u[0](0, lo)); });
+				int k = 0;
+				b.run("numa stencil", std::string(m.second) + (steal ? "" : " fixed"), n, threads, 1, [&]{ u[1-k].parallel_stencil<1>(p, u[k], stencil_rule); k = 1 - k; });
+			}
+		}
+	}
+
+	//Known patterns on a dense torus against HashLife on the unbounded plane, at a few step sizes.
+	for(auto const& p : patterns)
+	{
+		const int n = 1024;
+		std::array<Table2D<char>, 2> t;
+		t[0].resize(n, n); t[1].resize(n, n);
+		p.place([&](int x, int y){ t[0](n/2 + x, n/2 + y) = 1; });
+		int idx = 0;
+		b.run("pool fill2", p.name, n, threads, 1, [&]{ t[1-idx].parallel_fill2(pool, wrapped_rule(t[idx])); idx = 1 - idx; });
+
+		ActiveLife active;
+		active.resize(n, n);
+		p.place([&](int x, int y){ active.set(n/2 + x, n/2 + y, true); });
+		b.run("active bitlife", p.name, n, 1, 1, [&]{ active.step(); });
+
+		SparseLife sparse;
+		p.place([&](int x, int y){ sparse.set(x, y, true); });
+		b.run("sparse", p.name, 0, 1, 1, [&]{ sparse.step(); });
+
+		for(int s : {0, 8, 16, 24})
+		{
+			HashLife h;
+			h.stepLog2 = s;
+			p.place([&](int x, int y){ h.set(x, y, true); });
+			b.run("hashlife 2^" + std::to_string(s), p.name, 0, 1, 1L << s, [&]{ h.step(); });
+		}
+	}
+
+	//Pattern files of random boards written to and read back from a temporary file, a generation is one pass over
+	//the board so cells/s is the throughput.
+	for(int n : {1024, 4096})
+	{
+		std::mt19937 mt(42);
+		Table2D<char> t, u;
+		t.resize(n, n); u.resize(n, n);
+		t.fill1([&](int)->char{ return mt() & 1; });
+		FILE* rle = tmpfile();
+		FILE* mc = tmpfile();
+		if(!rle || !mc){ printf("Cannot open a temporary file\n"); return 1; }
+		b.run("rle write", n, 1, [&]{ rewind(rle); save_rle(rle, t, conway); });
+		fprintf(out, "%-*s %-12s %.1f MB\n", b.width, "", "rle file", ftell(rle) / 1e6);
+		b.run("rle read", n, 1,  [&]{ rewind(rle); load_rle(rle, u); });
+		b.run("mc write", n, 1,  [&]{ rewind(mc); save_macrocell(mc, t, conway); });
+		fprintf(out, "%-*s %-12s %.1f MB\n", b.width, "", "mc file", ftell(mc) / 1e6);
+		b.run("mc read", n, 1,   [&]{ rewind(mc); load_macrocell(mc, u, 0, 0); });
+		fclose(rle);
+		fclose(mc);
+	}
+
+	return b.write(json) ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+#include <iostream>
+#include <new>
+#include "miniwindow.h"
+
+//Every allocation in the process goes through here, so allocations per call can be reported.
+static std::atomic<long> allocations{0};
+
+//Arrays as well, all of them on malloc and free so that every new matches its delete. Kept out of line, as GCC
+//otherwise sees free inlined next to a new expression and takes it for a mismatch.
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE
+#endif
+BENCH_NOINLINE void* operator new(size_t n)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if(void* p = malloc(n ? n : 1)){ return p; }
+	throw std::bad_alloc{};
+}
+BENCH_NOINLINE void* operator new[](size_t n){ return operator new(n); }
+BENCH_NOINLINE void operator delete(void* p) noexcept { free(p); }
+BENCH_NOINLINE void operator delete(void* p, size_t) noexcept { free(p); }
+BENCH_NOINLINE void operator delete[](void* p) noexcept { free(p); }
+BENCH_NOINLINE void operator delete[](void* p, size_t) noexcept { free(p); }
+
+struct Result
+{
+	std::string primitive, shape;
+	int w, h, threads;
+	long calls;
+	double ns_per_call, pixels_per_call, allocs_per_call;
+
+	double ns_per_pixel() const { return pixels_per_call > 0 ? ns_per_call / pixels_per_call : 0.0; }
+	double pixels_per_s() const { return ns_per_call > 0 ? pixels_per_call / ns_per_call * 1e9 : 0.0; }
+};
+
+struct Bench
+{
+	SoftwareRenderer r;
+	std::vector<Result> results;
+	double min_ms = 50.0;
+	FILE* log = stdout;    //The table, stderr when the JSON goes to stdout.
+
+	//Pixels a primitive writes, counted once on a cleared backbuffer.
+	template<typename F>
+	long touched(F&& f)
+	{
+		const auto bg = color(1, 2, 3, 4);
+		r.clear(bg);
+		f();
+		long n = 0;
+		for(auto const& c : r.backbuffer.data){ if(packed_color(c) != packed_color(bg)){ n += 1; } }
+		return n;
+	}
+
+	template<typename F>
+	void run(std::string const& primitive, std::string const& shape, F&& f)
+	{
+		const long pixels = touched(f);
+		f();//warm-up
+		long calls = 0, allocs = 0;
+		double ms = 0.0;
+		for(long batch = 1; ms < min_ms; batch *= 2)
+		{
+			auto a0 = allocations.load();
+			auto t0 = std::chrono::high_resolution_clock::now();
+			for(long i=0; i<batch; ++i){ f(); }
+			auto t1 = std::chrono::high_resolution_clock::now();
+			allocs += allocations.load() - a0;
+			ms += (static_cast<std::chrono::duration<double, std::milli>>(t1-t0)).count();
+			calls += batch;
+		}
+		Result res{primitive, shape, r.backbuffer.w, r.backbuffer.h, r.threads(), calls, ms * 1e6 / calls, (double)pixels, (double)allocs / calls};
+		fprintf(log, "%-14s %-24s %5i x %-5i %3i  %12.1f %12.0f %10.3f %10.1f %8.2f\n", primitive.c_str(), shape.c_str(), res.w, res.h, res.threads,
+			res.ns_per_call, res.pixels_per_call, res.ns_per_pixel(), res.pixels_per_s() / 1e6, res.allocs_per_call);
+		results.push_back(res);
+	}
+
+	void write_json(FILE* f) const
+	{
+		fprintf(f, "{\n  \"benchmark\": \"miniwnd_bench\",\n  \"results\": [\n");
+		for(size_t i=0; i<results.size(); ++i)
+		{
+			auto const& res = results[i];
+			fprintf(f, "    {\"primitive\": \"%s\", \"shape\": \"%s\", \"width\": %i, \"height\": %i, \"threads\": %i, \"calls\": %ld, "
+			           "\"ns_per_call\": %.3f, \"pixels_per_call\": %.0f, \"ns_per_pixel\": %.5f, \"pixels_per_s\": %.1f, \"allocs_per_call\": %.3f}%s\n",
+				res.primitive.c_str(), res.shape.c_str(), res.w, res.h, res.threads, res.calls,
+				res.ns_per_call, res.pixels_per_call, res.ns_per_pixel(), res.pixels_per_s(), res.allocs_per_call, i+1 < results.size() ? "," : "");
+		}
+		fprintf(f, "  ]\n}\n");
+	}
+};
+
+int main(int argc, char** argv)
+{
+	Bench b;
+	std::string json;
+	for(int i=1; i<argc; ++i)
+	{
+		std::string a = argv[i];
+		if     (a == "--json" && i+1 < argc){ json = argv[++i]; }
+		else if(a == "--quick"){ b.min_ms = 5.0; }
+		else{ printf("Usage: %s [--json <file>|-] [--quick]\n", argv[0]); return 1; }
+	}
+	//Keep stdout clean for the JSON.
+	FILE* out = json == "-" ? stderr : stdout;
+	b.log = out;
+
+	fprintf(out, "%-14s %-24s %13s %3s  %12s %12s %10s %10s %8s\n", "primitive", "shape", "buffer", "thr", "ns/call", "pixels/call", "ns/pixel", "Mpixels/s", "allocs");
+
+	auto col = color(255, 64, 0);
+	auto fcol = [=](Color){ return col; };
+
+	//Full-buffer operations over a sweep of backbuffer sizes.
+	const Size2D sizes[] = { {640, 480}, {1920, 1080}, {3840, 2160} };
+	for(auto const& sz : sizes)
+	{
+		b.r.init(sz.w, sz.h);
+		b.run("clear",         "full",     [&]{ b.r.clear(col); });
+		b.run("forall_pixels", "constant", [&]{ b.r.forall_pixels([=](int, int, Color){ return col; }); });
+		b.run("forall_pixels", "gradient", [&]{ b.r.forall_pixels([](int x, int y, Color){ return color(x & 255, y & 255, (x ^ y) & 255); }); });
+	}
+
+	//Primitives on a 4K backbuffer over a sweep of sizes and shapes.
+	b.r.init(3840, 2160);
+	const int cx = 1920, cy = 1080;
+	for(int len : {16, 256, 2048})
+	{
+		auto s = std::to_string(len);
+		b.run("line", "horizontal " + s, [&]{ b.r.line(cx - len/2, cy, cx + len/2, cy, fcol); });
+		b.run("line", "vertical " + s,   [&]{ b.r.line(cx, cy - len/4, cx, cy + len/4, fcol); });
+		b.run("line", "diagonal " + s,   [&]{ b.r.line(cx - len/4, cy - len/4, cx + len/4, cy + len/4, fcol); });
+	}
+	for(int w : {256, 1024, 3600})
+	{
+		auto s = std::to_string(w) + "x1000";
+		b.run("lineplot", "range " + s,     [&]{ b.r.lineplot(100, 100, w, 1000, 0.0, 20.0, -1.0, 1.0, col, [](double x){ return std::sin(x); }); });
+		b.run("lineplot", "autorange " + s, [&]{ b.r.lineplot(100, 100, w, 1000, 0.0, 20.0, col, [](double x){ return std::sin(x); }); });
+	}
+	for(int n : {16, 256, 2048})
+	{
+		std::vector<float> values(n);
+		for(int i=0; i<n; ++i){ values[i] = std::sin(i * 0.05f); }
+		b.run("barplot", std::to_string(n) + " bars 3600x1000", [&]{ b.r.barplot(100, 100, 3600, 1000, values.begin(), values.end(), col); });
+	}
+	for(int e : {64, 512, 2048})
+	{
+		auto s = std::to_string(e) + "x" + std::to_string(e);
+		b.run("plot_by_index", s, [&]{ b.r.plot_by_index(cx - e/2, cy - e/2, e, e, [](int x, int y){ return ((x >> 3) + (y >> 3)) & 1 ? color(200, 200, 200) : color(64, 64, 64); }); });
+		b.run("filledrect", s,    [&]{ b.r.filledrect(cx - e/2, cy - e/2, e, e, col); });
+		b.run("filledrect", "1x" + std::to_string(e), [&]{ b.r.filledrect(cx, cy - e/2, 1, e, col); });
+	}
+	for(float e : {32.0f, 512.0f, 1000.0f})
+	{
+		auto s = std::to_string((int)e);
+		b.run("triangle", "functor " + s, [&]{ b.r.triangle(cx - e, cy - e/2, cx + e, cy - e/3, cx - e/4, cy + e/2, fcol); });
+		b.run("triangle", "color " + s,   [&]{ b.r.triangle(cx - e, cy - e/2, cx + e, cy - e/3, cx - e/4, cy + e/2, col); });
+		b.run("triangle", "thin " + s,    [&]{ b.r.triangle(cx - e, (float)cy, cx + e, cy + 2.0f, (float)cx, cy + 4.0f, col); });
+	}
+	for(int a : {16, 256, 1000})
+	{
+		b.run("ellipse", "circle " + std::to_string(a), [&]{ b.r.ellipse(cx, cy, a, a, fcol); });
+		b.run("ellipse", "flat " + std::to_string(a),   [&]{ b.r.ellipse(cx, cy, a, std::max(1, a/8), fcol); });
+	}
+
+	//Thread scaling of the tiled primitives, from the single-threaded baseline.
+	const int max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+	std::vector<int> thread_counts;
+	for(int n=1; n<max_threads; n *= 2){ thread_counts.push_back(n); }
+	thread_counts.push_back(max_threads);
+	for(int n : thread_counts)
+	{
+		b.r.threads(n);
+		b.run("forall_pixels", "gradient",  [&]{ b.r.forall_pixels([](int x, int y, Color){ return color(x & 255, y & 255, (x ^ y) & 255); }); });
+		b.run("plot_by_index", "3840x2160", [&]{ b.r.plot_by_index(0, 0, 3840, 2160, [](int x, int y){ return ((x >> 3) + (y >> 3)) & 1 ? color(200, 200, 200) : color(64, 64, 64); }); });
+		b.run("filledrect",    "3840x2160", [&]{ b.r.filledrect(0, 0, 3840, 2160, col); });
+	}
+	b.r.threads(1);
+
+	if(json == "-"){ b.write_json(stdout); }
+	else if(!json.empty())
+	{
+		FILE* f = fopen(json.c_str(), "w");
+		if(!f){ printf("Cannot open %s\n", json.c_str()); return 1; }
+		b.write_json(f);
+		fclose(f);
+	}
+	return 0;
+}
@@ -1 +1 @@
-g++ main.cpp -std=c++14 -I/usr/include/X11 -lX11 -o miniwnd.out
+g++ main.cpp -std=c++14 -I/usr/include/X11 -lX11 -lXext -o miniwnd.out
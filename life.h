@@ -0,0 +1,1065 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include <string>
+#include <utility>
+#include "miniwindow.h"
+
+namespace LifeDetails
+{
+	inline int popcount(uint64_t v)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_popcountll(v);
+#else
+		v = v - ((v >> 1) & 0x5555555555555555ull);
+		v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+		v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return (int)((v * 0x0101010101010101ull) >> 56);
+#endif
+	}
+
+	//Index of the lowest set bit, v must not be 0.
+	inline int ctz(uint64_t v)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return __builtin_ctzll(v);
+#else
+		int n = 0;
+		while(!(v & 1)){ v >>= 1; n += 1; }
+		return n;
+#endif
+	}
+
+	//Neighbours to the west and east of every cell of word i in a row of n words, wrapping around at the edges.
+	//Cell x is bit x%64 of word x/64, the unused high bits of the last word are zero.
+	struct Shifted{ uint64_t w, c, e; };
+	inline Shifted shifted(uint64_t const* row, int i, int n, int w)
+	{
+		const int last = (w - 1) & 63;
+		const uint64_t c = row[i];
+		const uint64_t west_in = i > 0   ? row[i-1] >> 63 : (row[n-1] >> last) & 1;
+		const uint64_t east_in = i < n-1 ? row[i+1] & 1   : row[0] & 1;
+		const int east_at = i < n-1 ? 63 : last;
+		return Shifted{ (c << 1) | west_in, c, (c >> 1) | (east_in << east_at) };
+	}
+
+	//Conway's rule on 64 cells at once: counts the 8 neighbours with a bit-sliced adder.
+	inline uint64_t conway(Shifted a, Shifted b, Shifted c)
+	{
+		//Above and below: 3 cells each summed to 2 bits, the own row has 2 neighbours.
+		const uint64_t a0 = a.w ^ a.c ^ a.e, a1 = (a.w & a.c) | (a.e & (a.w ^ a.c));
+		const uint64_t c0 = c.w ^ c.c ^ c.e, c1 = (c.w & c.c) | (c.e & (c.w ^ c.c));
+		const uint64_t b0 = b.w ^ b.e,       b1 = b.w & b.e;
+		//sum = s0 + 2 * (a1 + b1 + c1 + carry), alive next if the bracket is exactly 1 and s0 or the cell is set.
+		const uint64_t s0 = a0 ^ b0 ^ c0, carry = (a0 & b0) | (c0 & (a0 ^ b0));
+		const uint64_t x = a1 ^ b1, y = c1 ^ carry;
+		const uint64_t one = (x ^ y) & ~((a1 & b1) | (c1 & carry) | (x & y));
+		return one & (s0 | b.c);
+	}
+
+	//Words [i0, i1) of the next generation of the row mid of a board of width w, returns the changed bits.
+	inline uint64_t step_row(uint64_t const* above, uint64_t const* mid, uint64_t const* below, uint64_t* dst, int i0, int i1, int n, int w)
+	{
+		const uint64_t mask = (w & 63) ? (1ull << (w & 63)) - 1 : ~0ull;
+		uint64_t diff = 0;
+		for(int i=i0; i<i1; ++i)
+		{
+			dst[i] = conway(shifted(above, i, n, w), shifted(mid, i, n, w), shifted(below, i, n, w));
+			if(i == n-1){ dst[i] &= mask; }
+			diff |= dst[i] ^ mid[i];
+		}
+		return diff;
+	}
+}
+
+//Life-like and Generations rules. Bit n of birth / survive is set if a dead / live cell with n live neighbours is
+//alive in the next generation. Generations rules have states > 2: a live cell that does not survive goes through
+//the dying states 2 .. states-1 and back to 0, only state 1 counts as a live neighbour. Cells are chars, so at
+//most 127 states. parse accepts "B3/S23" (also "b3s23"), "B2/S/C3", and the numeric S/B and S/B/C forms "23/3",
+//"/2/3"; an empty string is not a rule. In the letter form every field comes once and a '/' is followed by a
+//letter, so "B3/23" and "B3S23/2" are rejected. It is constexpr, so a rule string can be compiled along with the program:
+//	constexpr Rule conway = Rule::parse("B3/S23"); static_assert(conway.valid, "");
+struct Rule
+{
+	uint16_t birth, survive;
+	int states;
+	bool valid;
+
+	static constexpr Rule parse(char const* s)
+	{
+		Rule r{0, 0, 2, false};
+		if(*s == 0){ return r; }
+		auto is_letter = [](char ch){ return ch == 'B' || ch == 'b' || ch == 'S' || ch == 's' || ch == 'C' || ch == 'c'; };
+		bool letters = false;
+		for(char const* p = s; *p; ++p){ if(is_letter(*p)){ letters = true; } }
+		//The field being read: 0 birth, 1 survive, 2 states; which fields the numeric form has in which order, and
+		//which the letter form has had.
+		int field = letters ? -1 : 1, fields = 0, number = -1, seen = 0;
+		for(char const* p = s; ; ++p)
+		{
+			const char ch = *p;
+			const bool letter = is_letter(ch);
+			if(ch == 0 || ch == '/' || letter)
+			{
+				if(field == 2)
+				{
+					if(number < 2 || number > 127){ return r; }
+					r.states = number;
+				}
+				if(ch == 0){ break; }
+				if(letter)
+				{
+					field = (ch == 'B' || ch == 'b') ? 0 : (ch == 'S' || ch == 's') ? 1 : 2; number = -1;
+					if(seen & (1 << field)){ return r; }
+					seen |= 1 << field;
+				}
+				else if(letters)
+				{
+					//B3/S23: the '/' only separates, the next field is named by its letter.
+					if(!is_letter(p[1])){ return r; }
+					field = -1;
+				}
+				else
+				{
+					//S/B/C
+					fields += 1;
+					if(fields > 2){ return r; }
+					field = fields == 1 ? 0 : 2; number = -1;
+				}
+				continue;
+			}
+			if(ch < '0' || ch > '9' || field < 0){ return r; }
+			if(field == 2){ number = (number < 0 ? 0 : number * 10) + (ch - '0'); if(number > 127){ return r; } }
+			else
+			{
+				if(ch > '8'){ return r; }
+				(field == 0 ? r.birth : r.survive) |= (uint16_t)(1u << (ch - '0'));
+			}
+		}
+		r.valid = true;
+		return r;
+	}
+
+	std::string str() const
+	{
+		std::string s = "B";
+		for(int n=0; n<=8; ++n){ if((birth >> n) & 1){ s += (char)('0' + n); } }
+		s += "/S";
+		for(int n=0; n<=8; ++n){ if((survive >> n) & 1){ s += (char)('0' + n); } }
+		if(states > 2){ s += "/C" + std::to_string(states); }
+		return s;
+	}
+
+	//Stencil kernels for Table2D, with R = 1, branch-free on chars so that the interior loop vectorizes.
+	//A rule known at compile time only compares the counts in its masks, which is as fast as a hand-written kernel.
+	template<uint16_t Birth, uint16_t Survive, int States = 2>
+	struct StaticKernel
+	{
+		//Whether count i is in mask M.
+		template<uint32_t M, int... K>
+		static char in(char i, std::integer_sequence<int, K...>){ return (char)(((((M >> K) & 1) ? (char)(i == K) : (char)0) | ...)); }
+
+		template<typename N>
+		char operator()(N const& n) const
+		{
+			const auto counts = std::make_integer_sequence<int, 9>{};
+			const char c = n(0, 0);
+			if constexpr(States == 2)
+			{
+				const char sum = n(-1, -1) + n(0, -1) + n(1, -1)
+				               + n(-1,  0) +            n(1,  0)
+				               + n(-1,  1) + n(0,  1) + n(1,  1);
+				return (char)((in<Birth>(sum, counts) & (char)(c == 0)) | (in<Survive>(sum, counts) & c));
+			}
+			else
+			{
+				const char sum = (char)((n(-1, -1) == 1) + (n(0, -1) == 1) + (n(1, -1) == 1)
+				                      + (n(-1,  0) == 1) +                   (n(1,  0) == 1)
+				                      + (n(-1,  1) == 1) + (n(0,  1) == 1) + (n(1,  1) == 1));
+				const char r = (char)((in<Birth>(sum, counts) & (char)(c == 0)) | (in<Survive>(sum, counts) & (char)(c == 1)));
+				//Live cells that do not survive and dying cells age by one state, r - 1 masks them as r is 0 or 1.
+				const char older = (char)(c + 1 == States ? 0 : c + 1);
+				return (char)(r | (older & (char)(r - 1) & (char)-(char)(c != 0)));
+			}
+		}
+	};
+
+	//Any rule at run time, every count is compared against the masks.
+	struct LifeKernel
+	{
+		uint16_t birth, survive;
+
+		template<typename N>
+		char operator()(N const& n) const
+		{
+			const char c = n(0, 0);
+			const char sum = n(-1, -1) + n(0, -1) + n(1, -1)
+			               + n(-1,  0) +            n(1,  0)
+			               + n(-1,  1) + n(0,  1) + n(1,  1);
+			char r = 0;
+			for(int k=0; k<9; ++k)
+			{
+				const char b = (char)((birth >> k) & 1), s = (char)((survive >> k) & 1);
+				r |= (char)((sum == k) & (c ? s : b));
+			}
+			return r;
+		}
+	};
+
+	struct GenerationsKernel
+	{
+		uint16_t birth, survive;
+		char states;
+
+		template<typename N>
+		char operator()(N const& n) const
+		{
+			const char c = n(0, 0);
+			const char sum = (char)((n(-1, -1) == 1) + (n(0, -1) == 1) + (n(1, -1) == 1)
+			                      + (n(-1,  0) == 1) +                   (n(1,  0) == 1)
+			                      + (n(-1,  1) == 1) + (n(0,  1) == 1) + (n(1,  1) == 1));
+			char born = 0, stays = 0;
+			for(int k=0; k<9; ++k)
+			{
+				const char b = (char)((birth >> k) & 1), s = (char)((survive >> k) & 1);
+				born  |= (char)((sum == k) & b);
+				stays |= (char)((sum == k) & s);
+			}
+			const char r = (char)((born & (char)(c == 0)) | (stays & (char)(c == 1)));
+			const char next = (char)(c + 1);
+			const char older = next == states ? (char)0 : next;
+			//Not with a condition on r, GCC turns that into a bool and gives up vectorizing.
+			return (char)(r | (older & (char)(r - 1) & (char)-(char)(c != 0)));
+		}
+	};
+
+	//Calls f with a kernel for this rule, e.g.
+	//	rule.with_kernel([&](auto const& k){ dst.parallel_stencil<1>(src, k); });
+	//Well-known rules get kernels compiled for them, others the run time one. A rule fixed at compile time gets a
+	//compiled kernel through the static overload below.
+	template<typename F>
+	void with_kernel(F&& f) const
+	{
+		constexpr Rule conway = parse("B3/S23"), highlife = parse("B36/S23"), daynight = parse("B3678/S34678");
+		constexpr Rule seeds = parse("B2/S"), brain = parse("B2/S/C3"), starwars = parse("B2/S345/C4");
+		if(with_static<conway.birth, conway.survive, conway.states>(f)){ return; }
+		if(with_static<highlife.birth, highlife.survive, highlife.states>(f)){ return; }
+		if(with_static<daynight.birth, daynight.survive, daynight.states>(f)){ return; }
+		if(with_static<seeds.birth, seeds.survive, seeds.states>(f)){ return; }
+		if(with_static<brain.birth, brain.survive, brain.states>(f)){ return; }
+		if(with_static<starwars.birth, starwars.survive, starwars.states>(f)){ return; }
+		if(states == 2){ f(LifeKernel{birth, survive}); }
+		else{ f(GenerationsKernel{birth, survive, (char)states}); }
+	}
+
+	//Calls f with the kernel compiled for any rule known at compile time, e.g.
+	//	constexpr Rule r = Rule::parse("B34/S34");
+	//	Rule::with_kernel<r.birth, r.survive, r.states>([&](auto const& k){ dst.parallel_stencil<1>(src, k); });
+	template<uint16_t Birth, uint16_t Survive, int States, typename F>
+	static void with_kernel(F&& f)
+	{
+		static_assert(States >= 2 && States <= 127, "Rules have 2 to 127 states");
+		static_assert(Birth < 512 && Survive < 512, "Neighbour counts go up to 8");
+		f(StaticKernel<Birth, Survive, States>{});
+	}
+
+	template<uint16_t Birth, uint16_t Survive, int States, typename F>
+	bool with_static(F& f) const
+	{
+		if(birth != Birth || survive != Survive || states != States){ return false; }
+		f(StaticKernel<Birth, Survive, States>{});
+		return true;
+	}
+};
+
+//Game of Life board with 64 cells per word on a torus. A generation is computed with word-wide logic only,
+//rows can be stepped independently (e.g. in parallel) with step_rows before calling swap.
+struct BitLife
+{
+	std::vector<uint64_t> cells, next;
+	int w, h, words; //words per row
+	int depth;       //Generations per pass of step(n).
+	int band;        //Rows per band in step(n), 0 picks bands of about 256 KB.
+
+	BitLife():cells{}, next{}, w{0}, h{0}, words{0}, depth{8}, band{0}{}
+
+	void resize(int w_, int h_)
+	{
+		w = std::max(w_, 0); h = std::max(h_, 0);
+		words = (w + 63) / 64;
+		cells.assign((size_t)words * (size_t)h, 0);
+		next.assign(cells.size(), 0);
+	}
+
+	int width() const { return w; }
+	int height() const { return h; }
+
+	uint64_t      * row(int y)       { return cells.data() + (size_t)y * (size_t)words; }
+	uint64_t const* row(int y) const { return cells.data() + (size_t)y * (size_t)words; }
+
+	bool get(int x, int y) const { return (row(y)[x >> 6] >> (x & 63)) & 1; }
+	void set(int x, int y, bool v)
+	{
+		auto& word = row(y)[x >> 6];
+		const uint64_t bit = 1ull << (x & 63);
+		word = v ? word | bit : word & ~bit;
+	}
+
+	void clear(){ std::fill(cells.begin(), cells.end(), 0); }
+
+	//Set every cell to f(x, y).
+	template<typename F>
+	void fill(F&& f)
+	{
+		for(int y=0; y<h; ++y)
+		{
+			auto r = row(y);
+			for(int i=0; i<words; ++i)
+			{
+				uint64_t v = 0;
+				const int n = std::min(64, w - i*64);
+				for(int b=0; b<n; ++b){ if(f(i*64 + b, y)){ v |= 1ull << b; } }
+				r[i] = v;
+			}
+		}
+	}
+
+	long population() const
+	{
+		long n = 0;
+		for(auto v : cells){ n += LifeDetails::popcount(v); }
+		return n;
+	}
+
+	//Compute rows [y0, y1) of the next generation into the second buffer.
+	void step_rows(int y0, int y1){ step_block(y0, y1, 0, words); }
+
+	//Compute words [i0, i1) of rows [y0, y1) into the second buffer, returns whether any cell of the block changed.
+	bool step_block(int y0, int y1, int i0, int i1)
+	{
+		if(words == 0){ return false; }
+		uint64_t diff = 0;
+		for(int y=y0; y<y1; ++y)
+		{
+			diff |= LifeDetails::step_row(row(y == 0 ? h-1 : y-1), row(y), row(y == h-1 ? 0 : y+1), next.data() + (size_t)y * (size_t)words, i0, i1, words, w);
+		}
+		return diff != 0;
+	}
+
+	void swap(){ cells.swap(next); }
+
+	void step(){ step_rows(0, h); swap(); }
+
+	//Advance n generations with temporal blocking: every band of rows is copied with a halo of depth rows on both
+	//sides into a scratch buffer that stays in cache, advanced there by up to depth generations while the valid
+	//part shrinks by a row per generation, and written back. Bands are independent, so there is no synchronisation
+	//between the generations of a pass.
+	void step(int n){ step_passes(n, nullptr); }
+	void step(int n, ThreadPool& pool){ step_passes(n, &pool); }
+
+	void step_passes(int n, ThreadPool* pool)
+	{
+		if(words == 0 || h == 0){ return; }
+		while(n > 0)
+		{
+			const int k = std::min(n, std::max(depth, 1));
+			const int rows = band > 0 ? band : std::max(4*k, 32768 / words - 2*k);
+			const int bands = (h + rows - 1) / rows;
+			auto f = [&](int lo, int hi){ for(int b=lo; b<hi; ++b){ advance_band(b * rows, std::min((b+1) * rows, h), k); } };
+			if(pool){ pool->parallel_chunks(bands, 1, f); }
+			else{ f(0, bands); }
+			swap();
+			n -= k;
+		}
+	}
+
+	//Rows [y0, y1) after k generations into the second buffer.
+	void advance_band(int y0, int y1, int k)
+	{
+		static thread_local std::vector<uint64_t> a, b;
+		const int rows = y1 - y0 + 2*k;
+		const size_t n = (size_t)words;
+		a.resize((size_t)rows * n);
+		b.resize((size_t)rows * n);
+		for(int r=0; r<rows; ++r)
+		{
+			const int y = ((y0 - k + r) % h + h) % h;
+			std::copy(row(y), row(y) + n, a.data() + (size_t)r * n);
+		}
+		uint64_t* src = a.data();
+		uint64_t* dst = b.data();
+		for(int g=1; g<=k; ++g)
+		{
+			for(int r=g; r<rows-g; ++r)
+			{
+				//The last generation goes straight to the band in the second buffer.
+				uint64_t* out = g == k ? next.data() + (size_t)(y0 + r - k) * n : dst + (size_t)r * n;
+				LifeDetails::step_row(src + (size_t)(r-1) * n, src + (size_t)r * n, src + (size_t)(r+1) * n, out, 0, words, words, w);
+			}
+			std::swap(src, dst);
+		}
+	}
+};
+
+//BitLife that only recomputes the tiles of 64 x 64 cells with a changed tile in their 3 x 3 neighbourhood.
+//A skipped tile and its neighbours were the same in the last two generations, so the second buffer already holds
+//its next generation. Tiles changed since the last take_touched are collected for the renderer.
+struct ActiveLife
+{
+	enum : int { TileWords = 1, TileRows = 64 };
+	BitLife board;
+	int tw, th;                         //Tiles per row and column.
+	std::vector<uint8_t> changed, next, touched;
+	long active;                        //Tiles changed by the last step.
+
+	ActiveLife():board{}, tw{0}, th{0}, active{0}{}
+
+	void resize(int w_, int h_)
+	{
+		board.resize(w_, h_);
+		tw = (board.words + TileWords - 1) / TileWords;
+		th = (board.h + TileRows - 1) / TileRows;
+		changed.assign((size_t)tw * (size_t)th, 1);
+		next.assign(changed.size(), 0);
+		touched.assign(changed.size(), 1);
+	}
+
+	int width() const { return board.w; }
+	int height() const { return board.h; }
+	int tile_width() const { return TileWords * 64; }
+	int tile_height() const { return TileRows; }
+	bool get(int x, int y) const { return board.get(x, y); }
+	long population() const { return board.population(); }
+
+	void invalidate(){ std::fill(changed.begin(), changed.end(), 1); touch_all(); }
+	void touch_all(){ std::fill(touched.begin(), touched.end(), 1); }
+	void touch(int x, int y)
+	{
+		const size_t t = (size_t)(y / TileRows) * (size_t)tw + (size_t)(x / (TileWords * 64));
+		changed[t] = touched[t] = 1;
+	}
+
+	void set(int x, int y, bool v){ board.set(x, y, v); touch(x, y); }
+
+	template<typename F>
+	void fill(F&& f){ board.fill(f); invalidate(); }
+
+	//Whether tile (i, j) or one of its neighbours on the torus changed in the last generation.
+	bool live(int i, int j) const
+	{
+		for(int dj=-1; dj<=1; ++dj)
+		{
+			const int jj = (j + dj + th) % th;
+			for(int di=-1; di<=1; ++di)
+			{
+				if(changed[(size_t)jj * (size_t)tw + (size_t)((i + di + tw) % tw)]){ return true; }
+			}
+		}
+		return false;
+	}
+
+	void step_tile(int t)
+	{
+		const int i = t % tw, j = t / tw;
+		if(!live(i, j)){ next[t] = 0; return; }
+		next[t] = board.step_block(j * TileRows, std::min((j+1) * TileRows, board.h), i * TileWords, std::min((i+1) * TileWords, board.words));
+	}
+
+	void step()
+	{
+		for(int t=0; t<tw*th; ++t){ step_tile(t); }
+		finish();
+	}
+
+	void step(ThreadPool& pool)
+	{
+		pool.parallel_chunks(tw * th, std::max(1, 64 / TileWords), [&](int lo, int hi){ for(int t=lo; t<hi; ++t){ step_tile(t); } });
+		finish();
+	}
+
+	void finish()
+	{
+		board.swap();
+		changed.swap(next);
+		active = 0;
+		for(size_t t=0; t<changed.size(); ++t)
+		{
+			touched[t] |= changed[t];
+			active += changed[t];
+		}
+	}
+
+	//Calls f(x0, y0, x1, y1) on the cell ranges of the tiles changed since the last call.
+	template<typename F>
+	void take_touched(F&& f)
+	{
+		for(int j=0; j<th; ++j)
+		{
+			for(int i=0; i<tw; ++i)
+			{
+				auto& t = touched[(size_t)j * (size_t)tw + (size_t)i];
+				if(!t){ continue; }
+				t = 0;
+				f(i * tile_width(), j * TileRows, std::min((i+1) * tile_width(), board.w), std::min((j+1) * TileRows, board.h));
+			}
+		}
+	}
+};
+
+//Pixel source for SoftwareRenderer::plot_by_index from any board with get(x, y).
+template<typename Board>
+auto life_pixels(Board const& board, Color live, Color dead)
+{
+	return [&board, live, dead](int x, int y){ return board.get(x, y) ? live : dead; };
+}
+
+//HashLife: the plane as a quadtree of canonical nodes, equal squares anywhere in space and time are stored once and
+//the future of every node is memoised, so regular patterns advance exponentially many generations in linear time.
+//Nodes live in one vector and refer to each other by index. Level 0 nodes are the dead (0) and the live (1) cell,
+//a node of level k is a 2^k square. The root is centred on the origin, it covers [-2^(k-1), 2^(k-1)) in x and y.
+struct HashLife
+{
+	using Index = uint32_t;
+	//The universe is a node of at most MaxLevel, cells from -2^61 to 2^61-1; set ignores cells outside of it and a
+	//step drops what grows across its edge. A step needs 3 levels above its size, so it advances at most 2^59.
+	enum : int { MaxLevel = 62, MaxStepLog2 = MaxLevel - 3 };
+	struct Node
+	{
+		Index nw, ne, sw, se;
+		Index next;            //Next node in the same hash bucket.
+		Index result;          //Centre after 2^resultStep generations, 0 if not computed yet.
+		uint8_t level, resultStep;
+		uint64_t population;
+	};
+
+	std::vector<Node> nodes;
+	std::vector<Index> buckets;  //Heads of the hash chains, a power of two long.
+	std::vector<Index> empties;  //The empty node of every level.
+	Index root;
+	int stepLog2;                //step() advances 2^stepLog2 generations, clamped to [0, MaxStepLog2].
+	uint64_t generation;
+	size_t maxNodes;             //Soft memory cap: nodes are collected before a step once past it, one step may go over.
+	long collections;
+
+	HashLife():root{0}, stepLog2{0}, generation{0}, maxNodes{size_t(1) << 24}, collections{0}{ clear(); }
+
+	void clear()
+	{
+		nodes.clear();
+		buckets.assign(1 << 16, 0);
+		empties.clear();
+		nodes.push_back(Node{0, 0, 0, 0, 0, 0, 0, 0, 0});
+		nodes.push_back(Node{0, 0, 0, 0, 0, 0, 0, 0, 1});
+		empties.push_back(0);
+		root = empty(3);
+		generation = 0;
+	}
+
+	int level() const { return nodes[root].level; }
+	uint64_t population() const { return nodes[root].population; }
+	size_t size() const { return nodes.size(); }
+	size_t bytes() const { return nodes.capacity() * sizeof(Node) + buckets.capacity() * sizeof(Index); }
+
+	static uint64_t hash(Index a, Index b, Index c, Index d)
+	{
+		uint64_t h = a * 0x9E3779B97F4A7C15ull;
+		h = (h ^ (h >> 29) ^ b) * 0xBF58476D1CE4E5B9ull;
+		h = (h ^ (h >> 31) ^ c) * 0x94D049BB133111EBull;
+		h = (h ^ (h >> 30) ^ d) * 0x9E3779B97F4A7C15ull;
+		return h ^ (h >> 32);
+	}
+
+	//The canonical node with these children.
+	Index join(Index a, Index b, Index c, Index d)
+	{
+		auto& head = buckets[hash(a, b, c, d) & (buckets.size() - 1)];
+		for(Index i = head; i != 0; i = nodes[i].next)
+		{
+			auto const& n = nodes[i];
+			if(n.nw == a && n.ne == b && n.sw == c && n.se == d){ return i; }
+		}
+		const Index i = (Index)nodes.size();
+		const uint64_t pop = nodes[a].population + nodes[b].population + nodes[c].population + nodes[d].population;
+		nodes.push_back(Node{a, b, c, d, head, 0, (uint8_t)(nodes[a].level + 1), 0, pop});
+		head = i;
+		if(nodes.size() > buckets.size()){ rehash(buckets.size() * 2); }
+		return i;
+	}
+
+	void rehash(size_t n)
+	{
+		buckets.assign(n, 0);
+		for(Index i=2; i<(Index)nodes.size(); ++i)
+		{
+			auto& nd = nodes[i];
+			auto& head = buckets[hash(nd.nw, nd.ne, nd.sw, nd.se) & (n - 1)];
+			nd.next = head;
+			head = i;
+		}
+	}
+
+	Index empty(int k)
+	{
+		while((int)empties.size() <= k){ auto e = empties.back(); empties.push_back(join(e, e, e, e)); }
+		return empties[k];
+	}
+
+	//The centred node of one level less.
+	Index centre(Index n)
+	{
+		const Node c = nodes[n];
+		return join(nodes[c.nw].se, nodes[c.ne].sw, nodes[c.sw].ne, nodes[c.se].nw);
+	}
+
+	//The same square in the centre of a node of one level more.
+	Index expand(Index n)
+	{
+		const Node c = nodes[n];
+		const Index e = empty(c.level - 1);
+		return join(join(e, e, e, c.nw), join(e, e, c.ne, e), join(e, c.sw, e, e), join(c.se, e, e, e));
+	}
+
+	//Level 2: the centre 2x2 cells after one generation, by counting.
+	Index base(Index n)
+	{
+		const Node c = nodes[n];
+		int g[4][4];
+		Index q[4] = {c.nw, c.ne, c.sw, c.se};
+		for(int k=0; k<4; ++k)
+		{
+			const Node s = nodes[q[k]];
+			const int ox = (k & 1) * 2, oy = (k >> 1) * 2;
+			g[oy][ox] = (int)s.nw; g[oy][ox+1] = (int)s.ne; g[oy+1][ox] = (int)s.sw; g[oy+1][ox+1] = (int)s.se;
+		}
+		auto next = [&](int x, int y)->Index
+		{
+			int sum = 0;
+			for(int dy=-1; dy<=1; ++dy){ for(int dx=-1; dx<=1; ++dx){ if(dx || dy){ sum += g[y+dy][x+dx]; } } }
+			return (Index)(sum == 3 || (sum == 2 && g[y][x]));
+		};
+		return join(next(1, 1), next(2, 1), next(1, 2), next(2, 2));
+	}
+
+	//The centre of node n after 2^min(stepLog2, level-2) generations.
+	Index result(Index n)
+	{
+		const Node c = nodes[n];
+		const int k = c.level;
+		const int e = std::min(stepLog2, k - 2);
+		if(c.result != 0 && c.resultStep == e){ return c.result; }
+		Index r;
+		if(k == 2){ r = base(n); }
+		else
+		{
+			const Node nw = nodes[c.nw], ne = nodes[c.ne], sw = nodes[c.sw], se = nodes[c.se];
+			//Nine overlapping squares of half the size, each advanced by up to a quarter of the full step.
+			const Index r00 = result(c.nw);
+			const Index r01 = result(join(nw.ne, ne.nw, nw.se, ne.sw));
+			const Index r02 = result(c.ne);
+			const Index r10 = result(join(nw.sw, nw.se, sw.nw, sw.ne));
+			const Index r11 = result(join(nw.se, ne.sw, sw.ne, se.nw));
+			const Index r12 = result(join(ne.sw, ne.se, se.nw, se.ne));
+			const Index r20 = result(c.sw);
+			const Index r21 = result(join(sw.ne, se.nw, sw.se, se.sw));
+			const Index r22 = result(c.se);
+			const Index q00 = join(r00, r01, r10, r11), q01 = join(r01, r02, r11, r12);
+			const Index q10 = join(r10, r11, r20, r21), q11 = join(r11, r12, r21, r22);
+			//The second quarter only at full speed, otherwise the first one already covered the step.
+			if(e == k - 2){ r = join(result(q00), result(q01), result(q10), result(q11)); }
+			else          { r = join(centre(q00), centre(q01), centre(q10), centre(q11)); }
+		}
+		nodes[n].result = r;
+		nodes[n].resultStep = (uint8_t)e;
+		return r;
+	}
+
+	bool padded(Index n) const
+	{
+		const Node c = nodes[n];
+		if(c.level < 3){ return false; }
+		auto inner = [&](Index q, int a, int b){ return nodes[child(child(q, a), b)].population; };
+		return c.population == inner(c.nw, 3, 3) + inner(c.ne, 2, 2) + inner(c.sw, 1, 1) + inner(c.se, 0, 0);
+	}
+
+	//Children by quadrant number: 0 nw, 1 ne, 2 sw, 3 se.
+	Index child(Index n, int q) const
+	{
+		auto const& c = nodes[n];
+		return q == 0 ? c.nw : q == 1 ? c.ne : q == 2 ? c.sw : c.se;
+	}
+
+	//Advance 2^stepLog2 generations. The node cap is only checked here, within the step nodes are held by index
+	//on the stack and cannot be collected; the larger stepLog2, the further a single step may go past maxNodes.
+	void step()
+	{
+		if(nodes.size() > maxNodes)
+		{
+			gc(true);
+			if(nodes.size() > maxNodes / 2){ gc(false); }
+		}
+		stepLog2 = std::min(std::max(stepLog2, 0), (int)MaxStepLog2);
+		//All live cells have to stay inside the result, which is half as wide: grow until they are in the central
+		//quarter and the step is at most an eighth of the width.
+		while((level() < stepLog2 + 3 || !padded(root)) && level() < MaxLevel){ root = expand(root); }
+		root = result(root);
+		generation += uint64_t(1) << stepLog2;
+	}
+
+	//Advance n generations with one step per set bit of n, bits above MaxStepLog2 as several steps of 2^MaxStepLog2.
+	void advance(uint64_t n)
+	{
+		const int saved = stepLog2;
+		for(int b=0; b<64; ++b)
+		{
+			if(((n >> b) & 1) == 0){ continue; }
+			stepLog2 = std::min(b, (int)MaxStepLog2);
+			for(uint64_t i=0; i < uint64_t(1) << (b - stepLog2); ++i){ step(); }
+		}
+		stepLog2 = saved;
+	}
+
+	bool inside(int64_t x, int64_t y) const
+	{
+		const int64_t half = int64_t(1) << (level() - 1);
+		return x >= -half && x < half && y >= -half && y < half;
+	}
+
+	bool get(int64_t x, int64_t y) const { return any(x, y, 0); }
+
+	//Whether the aligned 2^scale x 2^scale block containing cell (x, y) has live cells.
+	bool any(int64_t x, int64_t y, int scale) const
+	{
+		if(!inside(x, y)){ return false; }
+		Index n = root;
+		int64_t half = int64_t(1) << (level() - 1);
+		int64_t ox = -half, oy = -half;
+		for(int k = level(); k > scale && k > 0 && nodes[n].population > 0; --k)
+		{
+			half = int64_t(1) << (k - 1);
+			const int q = (x >= ox + half ? 1 : 0) + (y >= oy + half ? 2 : 0);
+			if(q & 1){ ox += half; }
+			if(q & 2){ oy += half; }
+			n = child(n, q);
+		}
+		return nodes[n].population > 0;
+	}
+
+	void set(int64_t x, int64_t y, bool v)
+	{
+		while(!inside(x, y))
+		{
+			if(level() >= MaxLevel){ return; }
+			root = expand(root);
+		}
+		const int64_t half = int64_t(1) << (level() - 1);
+		root = set(root, x + half, y + half, v);
+	}
+
+	//x, y relative to the corner of node n.
+	Index set(Index n, int64_t x, int64_t y, bool v)
+	{
+		const Node c = nodes[n];
+		if(c.level == 0){ return v ? 1 : 0; }
+		const int64_t half = int64_t(1) << (c.level - 1);
+		const int q = (x >= half ? 1 : 0) + (y >= half ? 2 : 0);
+		const Index s = set(child(n, q), x - (q & 1 ? half : 0), y - (q & 2 ? half : 0), v);
+		return join(q == 0 ? s : c.nw, q == 1 ? s : c.ne, q == 2 ? s : c.sw, q == 3 ? s : c.se);
+	}
+
+	//Replace the board by the w x h cells get(x, y), with cell (0, 0) at (x0, y0). Built bottom-up, empty
+	//quadrants are skipped.
+	template<typename F>
+	void build(int64_t x0, int64_t y0, int64_t w, int64_t h, F&& get)
+	{
+		clear();
+		int k = 3;
+		while(k < MaxLevel && (int64_t(1) << (k - 1)) < std::max({w + std::abs(x0), h + std::abs(y0), std::abs(x0), std::abs(y0)})){ k += 1; }
+		const int64_t half = int64_t(1) << (k - 1);
+		root = build(k, -half - x0, -half - y0, w, h, get);
+	}
+
+	//The node of level k whose top-left corner is cell (x, y) of the w x h source.
+	template<typename F>
+	Index build(int k, int64_t x, int64_t y, int64_t w, int64_t h, F& get)
+	{
+		const int64_t n = int64_t(1) << k;
+		if(x + n <= 0 || y + n <= 0 || x >= w || y >= h){ return empty(k); }
+		if(k == 0){ return get(x, y) ? 1 : 0; }
+		const int64_t half = n / 2;
+		return join(build(k-1, x, y, w, h, get), build(k-1, x + half, y, w, h, get), build(k-1, x, y + half, w, h, get), build(k-1, x + half, y + half, w, h, get));
+	}
+
+	//Calls f(x, y) on every live cell, skipping empty nodes.
+	template<typename F>
+	void for_each_live(F&& f) const
+	{
+		const int64_t half = int64_t(1) << (level() - 1);
+		for_each_live(root, -half, -half, f);
+	}
+
+	template<typename F>
+	void for_each_live(Index n, int64_t x, int64_t y, F& f) const
+	{
+		auto const& c = nodes[n];
+		if(c.population == 0){ return; }
+		if(c.level == 0){ f(x, y); return; }
+		const int64_t half = int64_t(1) << (c.level - 1);
+		for_each_live(c.nw, x, y, f);
+		for_each_live(c.ne, x + half, y, f);
+		for_each_live(c.sw, x, y + half, f);
+		for_each_live(c.se, x + half, y + half, f);
+	}
+
+	//Drops the nodes not reachable from the root and the empty nodes, and with keepResults the memoised futures
+	//of the remaining ones. Indices held outside of the board are invalid afterwards.
+	void gc(bool keepResults)
+	{
+		std::vector<Index> remap(nodes.size(), 0);
+		std::vector<Index> stack;
+		auto mark = [&](Index i){ if(remap[i] == 0){ remap[i] = 1; stack.push_back(i); } };
+		for(auto e : empties){ mark(e); }
+		mark(root);
+		while(!stack.empty())
+		{
+			const Node c = nodes[stack.back()];
+			stack.pop_back();
+			if(c.level == 0){ continue; }
+			mark(c.nw); mark(c.ne); mark(c.sw); mark(c.se);
+			if(keepResults && c.result != 0){ mark(c.result); }
+		}
+		Index n = 0;
+		for(Index i=0; i<(Index)nodes.size(); ++i){ remap[i] = (i < 2 || remap[i]) ? n++ : 0; }
+		std::vector<Node> kept;
+		kept.reserve(n);
+		for(Index i=0; i<(Index)nodes.size(); ++i)
+		{
+			if(i >= 2 && remap[i] == 0){ continue; }
+			Node c = nodes[i];
+			if(c.level > 0)
+			{
+				c.nw = remap[c.nw]; c.ne = remap[c.ne]; c.sw = remap[c.sw]; c.se = remap[c.se];
+				//A result that was not kept maps to 0, i.e. not computed.
+				c.result = keepResults ? remap[c.result] : 0;
+			}
+			kept.push_back(c);
+		}
+		nodes.swap(kept);
+		for(auto& e : empties){ e = remap[e]; }
+		root = remap[root];
+		size_t b = 1 << 16;
+		while(b < nodes.size()){ b *= 2; }
+		rehash(b);
+		collections += 1;
+	}
+};
+
+//Unbounded Game of Life board of 64 x 64 cell chunks in a hash map. Chunk (cx, cy) holds the cells
+//[64*cx, 64*cx+64) x [64*cy, 64*cy+64), row r as one word with cell x in bit x%64. A chunk is allocated when a
+//cell appears in it, by set or by the pattern growing over an edge, and freed once it is empty after a step,
+//so memory follows the live area and not the bounding box.
+struct SparseLife
+{
+	enum : int { Size = 64 };
+	struct Chunk
+	{
+		uint64_t cells[Size], next[Size];
+		int32_t cx, cy;
+	};
+
+	std::vector<Chunk> chunks;                     //Slots, the unused ones are listed in freeChunks.
+	std::vector<uint32_t> freeChunks;
+	std::unordered_map<uint64_t, uint32_t> index;  //Chunk key to slot.
+	std::vector<uint32_t> active;                  //Slots stepped by the current generation.
+	std::vector<uint64_t> touched;                 //Keys of the chunks changed since the last take_touched, if tracking.
+	bool tracking;
+	uint64_t generation;
+
+	SparseLife():chunks{}, freeChunks{}, index{}, active{}, touched{}, tracking{false}, generation{0}{}
+
+	static uint64_t key(int32_t cx, int32_t cy){ return ((uint64_t)(uint32_t)cy << 32) | (uint64_t)(uint32_t)cx; }
+
+	void clear(){ chunks.clear(); freeChunks.clear(); index.clear(); touched.clear(); generation = 0; }
+
+	size_t size() const { return index.size(); }
+	size_t bytes() const { return chunks.capacity() * sizeof(Chunk) + index.size() * (sizeof(uint64_t) + sizeof(uint32_t) + 2 * sizeof(void*)); }
+
+	long population() const
+	{
+		long n = 0;
+		for(auto const& kv : index){ for(auto v : chunks[kv.second].cells){ n += LifeDetails::popcount(v); } }
+		return n;
+	}
+
+	Chunk const* find(int32_t cx, int32_t cy) const
+	{
+		auto it = index.find(key(cx, cy));
+		return it == index.end() ? nullptr : &chunks[it->second];
+	}
+
+	//The slot of the chunk, allocated empty if missing. May move the chunks.
+	uint32_t chunk(int32_t cx, int32_t cy)
+	{
+		auto it = index.find(key(cx, cy));
+		if(it != index.end()){ return it->second; }
+		uint32_t s;
+		if(!freeChunks.empty()){ s = freeChunks.back(); freeChunks.pop_back(); }
+		else{ s = (uint32_t)chunks.size(); chunks.emplace_back(); }
+		auto& c = chunks[s];
+		std::fill(c.cells, c.cells + Size, 0);
+		c.cx = cx; c.cy = cy;
+		index.emplace(key(cx, cy), s);
+		return s;
+	}
+
+	bool get(int64_t x, int64_t y) const
+	{
+		auto c = find((int32_t)(x >> 6), (int32_t)(y >> 6));
+		return c && ((c->cells[y & 63] >> (x & 63)) & 1);
+	}
+
+	void set(int64_t x, int64_t y, bool v)
+	{
+		if(!v && !find((int32_t)(x >> 6), (int32_t)(y >> 6))){ return; }
+		auto& word = chunks[chunk((int32_t)(x >> 6), (int32_t)(y >> 6))].cells[y & 63];
+		const uint64_t bit = 1ull << (x & 63);
+		if(tracking && ((word & bit) != 0) != v){ touched.push_back(key((int32_t)(x >> 6), (int32_t)(y >> 6))); }
+		word = v ? word | bit : word & ~bit;
+	}
+
+	//Whether the aligned 2^scale x 2^scale block containing cell (x, y) has live cells.
+	bool any(int64_t x, int64_t y, int scale) const
+	{
+		if(scale <= 6)
+		{
+			auto c = find((int32_t)(x >> 6), (int32_t)(y >> 6));
+			if(!c){ return false; }
+			const int n = 1 << scale;
+			const int r0 = (int)(y & 63) & ~(n - 1);
+			const uint64_t mask = (n == 64 ? ~0ull : (1ull << n) - 1) << ((int)(x & 63) & ~(n - 1));
+			for(int r=r0; r<r0+n; ++r){ if(c->cells[r] & mask){ return true; } }
+			return false;
+		}
+		//Blocks of whole chunks: look them up one by one, or go over all chunks if there are fewer of those.
+		const int64_t n = int64_t(1) << std::min(scale - 6, 32);
+		const int64_t cx0 = (x >> 6) & ~(n - 1), cy0 = (y >> 6) & ~(n - 1);
+		auto nonempty = [](Chunk const& c){ for(auto v : c.cells){ if(v){ return true; } } return false; };
+		if(n <= (int64_t)index.size() / n)
+		{
+			for(int64_t cy=cy0; cy<cy0+n; ++cy){ for(int64_t cx=cx0; cx<cx0+n; ++cx)
+			{
+				auto c = find((int32_t)cx, (int32_t)cy);
+				if(c && nonempty(*c)){ return true; }
+			} }
+			return false;
+		}
+		for(auto const& kv : index)
+		{
+			auto const& c = chunks[kv.second];
+			if(c.cx >= cx0 && c.cx < cx0 + n && c.cy >= cy0 && c.cy < cy0 + n && nonempty(c)){ return true; }
+		}
+		return false;
+	}
+
+	void step(){ step_chunks(nullptr); }
+	void step(ThreadPool& pool){ step_chunks(&pool); }
+
+	void step_chunks(ThreadPool* pool)
+	{
+		//Births can only spill over an edge with live cells next to it, allocate those neighbours first.
+		struct Spill{ int32_t cx, cy; uint8_t sides; };
+		std::vector<Spill> spills;
+		for(auto const& kv : index)
+		{
+			auto const& c = chunks[kv.second];
+			uint64_t west = 0, east = 0;
+			for(auto v : c.cells){ west |= v & 1; east |= v >> 63; }
+			const uint64_t north = c.cells[0], south = c.cells[Size-1];
+			const uint8_t sides = (uint8_t)((north ? 1 : 0) | (south ? 2 : 0) | (west ? 4 : 0) | (east ? 8 : 0)
+			                    | (north & 1 ? 16 : 0) | (north >> 63 ? 32 : 0) | (south & 1 ? 64 : 0) | (south >> 63 ? 128 : 0));
+			if(sides){ spills.push_back(Spill{c.cx, c.cy, sides}); }
+		}
+		for(auto const& s : spills)
+		{
+			if(s.sides & 1){ chunk(s.cx, s.cy - 1); }
+			if(s.sides & 2){ chunk(s.cx, s.cy + 1); }
+			if(s.sides & 4){ chunk(s.cx - 1, s.cy); }
+			if(s.sides & 8){ chunk(s.cx + 1, s.cy); }
+			if(s.sides & 16){ chunk(s.cx - 1, s.cy - 1); }
+			if(s.sides & 32){ chunk(s.cx + 1, s.cy - 1); }
+			if(s.sides & 64){ chunk(s.cx - 1, s.cy + 1); }
+			if(s.sides & 128){ chunk(s.cx + 1, s.cy + 1); }
+		}
+
+		active.clear();
+		for(auto const& kv : index){ active.push_back(kv.second); }
+		auto f = [&](int lo, int hi){ for(int i=lo; i<hi; ++i){ step_chunk(chunks[active[i]]); } };
+		if(pool){ pool->parallel_chunks((int)active.size(), 16, f); }
+		else{ f(0, (int)active.size()); }
+
+		for(auto s : active)
+		{
+			auto& c = chunks[s];
+			if(tracking && !std::equal(c.next, c.next + Size, c.cells)){ touched.push_back(key(c.cx, c.cy)); }
+			std::copy(c.next, c.next + Size, c.cells);
+			uint64_t any = 0;
+			for(auto v : c.cells){ any |= v; }
+			if(!any){ index.erase(key(c.cx, c.cy)); freeChunks.push_back(s); }
+		}
+		generation += 1;
+	}
+
+	//Calls f(x0, y0, x1, y1) on the cell ranges of the chunks changed since the last call, including the ones that
+	//died out and were freed. Set tracking to collect them.
+	template<typename F>
+	void take_touched(F&& f)
+	{
+		std::sort(touched.begin(), touched.end());
+		touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+		for(auto k : touched)
+		{
+			const int64_t x0 = (int64_t)(int32_t)(uint32_t)k * Size, y0 = (int64_t)(int32_t)(uint32_t)(k >> 32) * Size;
+			f(x0, y0, x0 + Size, y0 + Size);
+		}
+		touched.clear();
+	}
+
+	//The next generation of one chunk, from its own cells and the edges of its 8 neighbours.
+	void step_chunk(Chunk& c) const
+	{
+		static const uint64_t none[Size] = {};
+		auto at = [&](int dx, int dy){ auto n = find(c.cx + dx, c.cy + dy); return n ? n->cells : none; };
+		//Columns west, centre and east of the chunk, with the row above and below it at 0 and Size+1.
+		uint64_t W[Size+2], C[Size+2], E[Size+2];
+		auto column = [&](uint64_t* col, int dx)
+		{
+			col[0] = at(dx, -1)[Size-1];
+			std::copy(at(dx, 0), at(dx, 0) + Size, col + 1);
+			col[Size+1] = at(dx, 1)[0];
+		};
+		column(W, -1); column(C, 0); column(E, 1);
+		auto row = [&](int r){ return LifeDetails::Shifted{ (C[r] << 1) | (W[r] >> 63), C[r], (C[r] >> 1) | (E[r] << 63) }; };
+		for(int r=0; r<Size; ++r){ c.next[r] = LifeDetails::conway(row(r), row(r+1), row(r+2)); }
+	}
+};
+
+//Maps pixels to cells: pixel (px, py) shows the 2^scale x 2^scale block of cells starting at (x + px*2^scale, y + py*2^scale).
+//A negative scale zooms in, every cell then covers 2^-scale x 2^-scale pixels.
+struct Viewport
+{
+	int64_t x, y;
+	int scale;
+};
+
+//Pixel source for SoftwareRenderer::plot_by_index from a board with any(x, y, scale), e.g. HashLife or SparseLife.
+template<typename Board>
+auto viewport_pixels(Board const& board, Viewport v, Color live, Color dead)
+{
+	return [&board, v, live, dead](int px, int py)
+	{
+		if(v.scale < 0){ return board.any(v.x + (px >> -v.scale), v.y + (py >> -v.scale), 0) ? live : dead; }
+		return board.any(v.x + ((int64_t)px << v.scale), v.y + ((int64_t)py << v.scale), v.scale) ? live : dead;
+	};
+}
@@ -2,129 +2,111 @@
 #include <array>
 #include <random>
 #include "miniwindow.h"
+#include "life.h"
 
-template<typename T>
-struct Table2D
+struct App
 {
-	std::vector<T> data;
-	int w, h;
+	MainWindow wnd;
+	int x, y, z;
 
-	Table2D():data{}, w{0}, h{0}{}
+	SparseLife board;
+	Viewport view;
+	Viewport shown;       //The view of the last frame, the backbuffer only needs the changed chunks while it stays.
+	Viewport grab;        //The view when the left button went down.
+	int grab_x, grab_y;
+	Color live, dead;
 
-	void resize(int w_, int h_, T const& val_ = (T)0)
+	//A random soup around the origin, the board is unbounded and independent of the window.
+	void Seed(int n)
 	{
-		data.resize((size_t)w_ * (size_t)h_, val_);
-		w = w_; h = h_;
+		board.clear();
+		std::mt19937 mt(42);
+		std::uniform_real_distribution<float> d(0.0, 1.0f);
+		for(int j=0; j<n; ++j){ for(int i=0; i<n; ++i){ board.set(i - n/2, j - n/2, d(mt) >= 0.5); } }
 	}
 
-	template<typename F>
-	void fill1(F&& f)
-	{
-		int n = size();
-		for(int i=0; i<n; ++i){ data[i] = f(i); }
-	}
+	//Cells covered by a distance in pixels at the current zoom.
+	int64_t Cells(int d) const { return view.scale >= 0 ? (int64_t)d << view.scale : (int64_t)(d / (1 << -view.scale)); }
 
-	template<typename F>
-	void fill2(F&& f)
+	//Pixels [p0, p1) showing the cells [c0, c1) along an axis of the view starting at cell origin.
+	void Pixels(int64_t origin, int64_t c0, int64_t c1, int64_t& p0, int64_t& p1) const
 	{
-		for(int i=0; i<w; ++i)
-		{
-			for(int j=0; j<h; ++j)
-			{
-				(*this)(i, j) = f(i, j);
-			}
-		}
+		if(view.scale >= 0){ p0 = (c0 - origin) >> view.scale; p1 = ((c1 - 1 - origin) >> view.scale) + 1; }
+		else{ p0 = (c0 - origin) << -view.scale; p1 = (c1 - origin) << -view.scale; }
 	}
 
-	int size() const { return w*h; }
-
-	T      & operator[](int i)       { return data[i]; }
-	T const& operator[](int i) const { return data[i]; }
-	T      & operator()(int x, int y)       { return data[(size_t)y*(size_t)w+(size_t)x]; }
-	T const& operator()(int x, int y) const { return data[(size_t)y*(size_t)w+(size_t)x]; }
-};
-
-struct App
-{
-	MainWindow wnd;
-	int x, y, z;
-
-	int idx;
-	std::array<Table2D<char>, 2> table;
-	Color live, dead;
-
-	void ResizeTables(int w, int h)
+	//Zoom by one step, keeping the cell under pixel (px, py) in place.
+	void Zoom(int px, int py, int dz)
 	{
-		if(w < 0 || h < 0){ w = h = 0; }
-		idx = 0;
-		table[0].resize(w, h);
-		table[1].resize(w, h);
-
-		{
-			std::mt19937 mt(42);
-			std::uniform_real_distribution<float> d(0.0, 1.0f);
-			table[0].fill1([&](int)->char{ return d(mt) < 0.5 ? 0 : 1; }); 
-			table[1].fill1([ ](int)->char{ return 0; });
-		}
+		const int64_t cx = view.x + Cells(px), cy = view.y + Cells(py);
+		view.scale = std::min(std::max(view.scale - dz, -4), 8);
+		view.x = cx - Cells(px);
+		view.y = cy - Cells(py);
 	}
 
 	App()
 	{
 		x = 0; y = 0, z = 0;
+		board.tracking = true;
+		view = shown = grab = Viewport{-320, -240, 0};
+		grab_x = grab_y = 0;
 
 		live = color(200, 200, 200);
 		dead = color(64, 64, 64);
+		Seed(256);
 	}
 
 	int enterApp()
 	{
 		wnd.window.eventDriven = false;
+		wnd.asyncPresent = true;
 
 		wnd.mouseHandler([&](Mouse const& m)
 		{ 
 			x = m.x; y = m.y;
 			
-			if     (m.event == Mouse::Move      ){            /*std::cout << "Mouse moved: " << x << " " << y << "\n";*/ }
-			else if(m.event == Mouse::Scroll    ){ z += m.dz; std::cout << "Mouse scrolled: " << z << "\n";  }
-			else if(m.event == Mouse::LeftDown  ){            std::cout << "Mouse Left Down\n"  ; }
+			//Drag to pan, scroll to zoom around the cursor, middle click to pause.
+			if     (m.event == Mouse::Move      ){ if(m.left){ view.x = grab.x - Cells(x - grab_x); view.y = grab.y - Cells(y - grab_y); } }
+			else if(m.event == Mouse::Scroll    ){ z += m.dz; Zoom(x, y, m.dz); printf("Scale: 2^%i cells per pixel\n", view.scale); }
+			else if(m.event == Mouse::LeftDown  ){ grab = view; grab_x = x; grab_y = y; }
 			else if(m.event == Mouse::LeftUp    ){            std::cout << "Mouse Left Up\n"    ; }
-			else if(m.event == Mouse::MiddleDown){            std::cout << "Mouse Middle Down\n"; }
+			else if(m.event == Mouse::MiddleDown){ wnd.window.paused = !wnd.window.paused; std::cout << (wnd.window.paused ? "Paused\n" : "Resumed\n"); }
 			else if(m.event == Mouse::MiddleUp  ){            std::cout << "Mouse Middle Up\n"  ; }
 			else if(m.event == Mouse::RightDown ){            std::cout << "Mouse Right Down\n" ; }
 			else if(m.event == Mouse::RightUp   ){            std::cout << "Mouse Right Up\n"   ; }
 		});
 		wnd.resizeHandler([&](int w, int h, StateChange /*sc*/)
 		{
-			ResizeTables(w-32, h-32);
 			printf("Resize: %i %i\n", w, h);
 		} );
 		wnd.idleHandler([&]
 		{
-			table[1 - idx].fill2([&t = table[idx]](int x, int y)->char
-			{
-				auto w = t.w;
-				auto h = t.h;
-				if(w < 1 || h < 1){ return 0; }
-				auto c = t(x, y);
-				auto xp1 = x == w-1 ? 0   : x+1;
-				auto xm1 = x == 0   ? w-1 : x-1;
-				auto yp1 = y == h-1 ? 0   : y+1;
-				auto ym1 = y == 0   ? h-1 : y-1;
-				auto sum = t(xm1, ym1) + t(x, ym1) + t(xp1, ym1)
-					     + t(xm1, y  ) +             t(xp1, y  )
-					     + t(xm1, yp1) + t(x, yp1) + t(xp1, yp1);
-				if(c == 0 &&  sum == 3           ){ return 1; }
-				if(c == 1 && (sum < 2 || sum > 3)){ return 0; }
-				return c;
-			});
-			idx = 1 - idx;
+			board.step();
+			if(board.generation % 1000 == 0){ printf("Generation %llu: %ld cells in %zu chunks\n", (unsigned long long)board.generation, board.population(), board.size()); }
 		});
 		wnd.exitHandler([&]{ });
 
 		wnd.renderHandler( [&](SoftwareRenderer& r)
 		{
-			r.forall_pixels([](auto, auto, auto){ return color(255, 255, 255); });
-			r.plot_by_index(16, 16, table[idx].w, table[idx].h, [&](auto x, auto y){ return table[idx](x, y) == 0 ? dead : live; });
+			const int W = r.backbuffer.w, H = r.backbuffer.h;
+			//Redraw everything after a resize, a pan or a zoom, otherwise only the pixels of the chunks that changed.
+			if(r.dirty.full || view.x != shown.x || view.y != shown.y || view.scale != shown.scale)
+			{
+				board.touched.clear();
+				shown = view;
+				r.plot_by_index(0, 0, W, H, viewport_pixels(board, view, live, dead));
+				return;
+			}
+			board.take_touched([&](int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+			{
+				int64_t px0, px1, py0, py1;
+				Pixels(view.x, x0, x1, px0, px1);
+				Pixels(view.y, y0, y1, py0, py1);
+				px0 = std::max(px0, (int64_t)0); px1 = std::min(px1, (int64_t)W);
+				py0 = std::max(py0, (int64_t)0); py1 = std::min(py1, (int64_t)H);
+				if(px0 >= px1 || py0 >= py1){ return; }
+				r.plot_by_index((int)px0, (int)py0, (int)(px1 - px0), (int)(py1 - py0), viewport_pixels(board, Viewport{view.x + Cells((int)px0), view.y + Cells((int)py0), view.scale}, live, dead));
+			});
 		});
 
 		bool res = wnd.open(L"C++ App", {42, 64}, {640, 480}, true, [&]{ return true; });
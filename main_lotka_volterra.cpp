@@ -75,7 +75,7 @@ struct App
 
 		wnd.renderHandler( [&](SoftwareRenderer& r)
 		{
-			r.forall_pixels([](auto, auto, auto){ return color(255, 255, 255); });
+			r.clear(color(255, 255, 255));
 			if(data.size() > 4)
 			{
 				r.lineplot(16, 16, wnd.width()-32, wnd.height()-32, 0.0, (double)(data.size()-1), 0.0, 100.0, color(128, 128, 128), [&](double i){ return data[(int)i].x; });
@@ -1,125 +1,133 @@
 #include <iostream>
 #include <array>
 #include <random>
-#include <future>
 #include "miniwindow.h"
+#include "table2d.h"
+#include "life.h"
+#include "patterns.h"
 
-template<typename T>
-struct Table2D
+struct App
 {
-	std::vector<T> data;
-	int w, h;
-
-	Table2D():data{}, w{0}, h{0}{}
+	Checkpoint checkpoint;                  //Mapped restored board, released after the window.
+	MainWindow wnd;
+	int x, y, z;
 
-	void resize(int w_, int h_, T const& val_ = (T)0)
+	int idx;
+	std::array<Table2D<char>, 2> table;     //Owned by the step thread.
+	ThreadPool pool;                         //Steps the tables, its threads stay on their NUMA node.
+	bool pinned;                             //Whether the step thread is pinned as thread 0 of the pool.
+	Size2D resizeTo;                         //Board size from the last resize, applied by the step thread. w < 0 if none is pending.
+	TripleBuffer<Table2D<char>> snapshot;    //Latest generation, for the renderer.
+	std::atomic<bool> frameWanted;           //The renderer took the last snapshot, the step thread publishes the next generation.
+	Rule rule;
+	std::vector<Color> palette;              //By cell state.
+	long last_steps;
+	std::chrono::steady_clock::time_point last_report;
+	std::string checkpoint_path;             //Saved on right click, restored at start if it exists.
+	std::string pattern_path;                //RLE or Macrocell file placed in the middle instead of the random fill.
+	Table2D<char> pattern;                   //Read from pattern_path once, before the window opens.
+	uint64_t generation;
+	bool restored, seeded;
+
+	//Read the pattern, cells in states the rule does not have come in as live.
+	bool LoadPattern()
 	{
-		data.resize((size_t)w_ * (size_t)h_, val_);
-		w = w_; h = h_;
+		PatternInfo info;
+		if(pattern_path.empty() || !load_pattern(pattern_path, pattern, &info, rule.states)){ return false; }
+		if(info.rule.str() != rule.str()){ printf("%s is a %s pattern, running it as %s\n", pattern_path.c_str(), info.rule.str().c_str(), rule.str().c_str()); }
+		return true;
 	}
 
-	template<typename F>
-	void fill1(F&& f)
+	//src into the middle of table[0], cropped to it.
+	void Place(Table2D<char> const& src)
 	{
-		int n = size();
-		for(int i=0; i<n; ++i){ data[i] = f(i); }
+		auto& t = table[0];
+		const int dx = (t.w - src.w) / 2, dy = (t.h - src.h) / 2;
+		const int x0 = std::max(0, -dx), x1 = std::min(src.w, t.w - dx);
+		for(int y=std::max(0, -dy); y<std::min(src.h, t.h - dy) && x0 < x1; ++y){ std::copy(&src(x0, y), &src(x0, y) + (x1 - x0), &t(x0 + dx, y + dy)); }
 	}
 
-	template<typename F>
-	void fill2(F&& f)
+	//Called on the step thread, so that it first-touches the rows it steps as thread 0 of the pool.
+	void ResizeTables(int w, int h)
 	{
-		for(int i=0; i<w; ++i)
+		//A restored board keeps its size.
+		if(restored)
 		{
-			for(int j=0; j<h; ++j)
-			{
-				(*this)(i, j) = f(i, j);
-			}
+			if(table[1].w != table[0].w || table[1].h != table[0].h){ table[1].resize(pool, table[0].w, table[0].h); }
+			return;
 		}
-	}
-
-    template<typename F>
-	void parallel_fill2(F&& f)
-	{
-        static const int n_threads = 4;
-
-        if(h < 100){ fill2(f); return; }
-
-        std::vector<std::future<void>> fs(n_threads);
-        int ilow = 0;
-        int idelta = h / n_threads;
-        int ihi = idelta;
-        
-        for(int t=0; t<n_threads; ++t)
-        {
-            if(t == n_threads-1){ ihi = h; }
-            //std::cout << ilow << "   " << ihi << std::endl;
-            fs[t] = std::async(std::launch::async, [this, f](int lo, int hi)
-            {
-                
-                for(int i=0; i<w; ++i)
-                {
-                    for(int j=lo; j<hi; ++j)
-                    {
-                        (*this)(i, j) = f(i, j);
-                    }
-                }
-            }, ilow, ihi);
-            ilow = ihi;
-            ihi += idelta;
-        }
-
-		std::for_each(fs.begin(), fs.end(), [](auto& fut){ fut.get(); });
-	}
-
-	int size() const { return w*h; }
-
-	T      & operator[](int i)       { return data[i]; }
-	T const& operator[](int i) const { return data[i]; }
-	T      & operator()(int x, int y)       { return data[(size_t)y*(size_t)w+(size_t)x]; }
-	T const& operator()(int x, int y) const { return data[(size_t)y*(size_t)w+(size_t)x]; }
-};
-
-struct App
-{
-	MainWindow wnd;
-	int x, y, z;
-
-	int idx;
-	std::array<Table2D<char>, 2> table;
-	Color live, dead;
-
-    double frame_time;
-    int frame_count;
-
-	void ResizeTables(int w, int h)
-	{
 		if(w < 0 || h < 0){ w = h = 0; }
+		//The first board gets the pattern or a random fill, later ones the board so far in their middle.
+		Table2D<char> old = std::move(table[idx]);
 		idx = 0;
-		table[0].resize(w, h);
-		table[1].resize(w, h);
-
+		//First touch by the threads that step the same rows.
+		table[0].resize(pool, w, h);
+		table[1].resize(pool, w, h);
+		if(seeded){ Place(old); }
+		else if(pattern.size() > 0){ Place(pattern); pattern = Table2D<char>{}; }
+		else
 		{
 			std::mt19937 mt(42);
 			std::uniform_real_distribution<float> d(0.0, 1.0f);
 			table[0].fill1([&](int)->char{ return d(mt) < 0.5 ? 0 : 1; }); 
-			table[1].fill1([ ](int)->char{ return 0; });
 		}
+		seeded = true;
+		Publish();
 	}
 
-	App()
+	//Run on from the checkpoint, mapped copy-on-write so that the file stays as it was saved.
+	bool Restore()
 	{
-		x = 0; y = 0, z = 0;
+		if(checkpoint_path.empty() || !checkpoint.open(checkpoint_path) || !checkpoint.attach(table[0])){ return false; }
+		idx = 0;
+		generation = checkpoint.generation();
+		restored = true;
+		Publish();
+		printf("Restored %i x %i board at generation %llu from %s\n", table[0].w, table[0].h, (unsigned long long)generation, checkpoint_path.c_str());
+		return true;
+	}
 
-		live = color(200, 200, 200);
-		dead = color(64, 64, 64);
+	void Save()
+	{
+		if(checkpoint_path.empty()){ return; }
+		auto lock = wnd.hold_step();
+		if(save_checkpoint(checkpoint_path, table[idx], generation)){ printf("Saved generation %llu to %s\n", (unsigned long long)generation, checkpoint_path.c_str()); }
+		//The board as a pattern next to the checkpoint.
+		if(save_pattern(checkpoint_path + ".rle", table[idx], rule)){ printf("Exported %s.rle\n", checkpoint_path.c_str()); }
+	}
 
-        frame_count = 0;
-        frame_time = 0.0;
+	void Publish()
+	{
+		snapshot.write_buffer() = table[idx];
+		snapshot.publish();
+	}
+
+	App(Rule rule_, std::string const& checkpoint_path_, std::string const& pattern_path_):pool{(int)std::max(1u, std::thread::hardware_concurrency()), ThreadPool::Nodes}, pinned{false}, resizeTo{-1, -1}, frameWanted{true}, rule{rule_}, checkpoint_path{checkpoint_path_}, pattern_path{pattern_path_}, generation{0}, restored{false}, seeded{false}
+	{
+		x = 0; y = 0, z = 0;
+		idx = 0;
+		last_steps = 0;
+		last_report = std::chrono::steady_clock::now();
+
+		//Dead, live, then the dying states of Generations rules fading towards dead.
+		palette.push_back(color(64, 64, 64));
+		palette.push_back(color(200, 200, 200));
+		for(int s=2; s<rule.states; ++s)
+		{
+			const int v = 64 + 136 * (rule.states - s) / rule.states;
+			palette.push_back(color(v, v / 2, 64));
+		}
 	}
 
 	int enterApp()
 	{
 		wnd.window.eventDriven = false;
+		wnd.sharedMemory = true;
+		wnd.window.stats.enable();
+		wnd.window.pacer.targetFps = 60.0;
+		wnd.asyncStep = true;
+		//Every band stays with its thread and node, the one it was first touched by.
+		pool.stealing = false;
 
 		wnd.mouseHandler([&](Mouse const& m)
 		{ 
@@ -129,54 +137,51 @@ struct App
 			else if(m.event == Mouse::Scroll    ){ z += m.dz; std::cout << "Mouse scrolled: " << z << "\n";  }
 			else if(m.event == Mouse::LeftDown  ){            std::cout << "Mouse Left Down\n"  ; }
 			else if(m.event == Mouse::LeftUp    ){            std::cout << "Mouse Left Up\n"    ; }
-			else if(m.event == Mouse::MiddleDown){            std::cout << "Mouse Middle Down\n"; }
+			else if(m.event == Mouse::MiddleDown){            wnd.window.paused = !wnd.window.paused; std::cout << (wnd.window.paused ? "Paused\n" : "Resumed\n"); }
 			else if(m.event == Mouse::MiddleUp  ){            std::cout << "Mouse Middle Up\n"  ; }
-			else if(m.event == Mouse::RightDown ){            std::cout << "Mouse Right Down\n" ; }
+			else if(m.event == Mouse::RightDown ){            Save(); }
 			else if(m.event == Mouse::RightUp   ){            std::cout << "Mouse Right Up\n"   ; }
 		});
+		//Called with the step lock held, the step thread picks the size up before its next step.
 		wnd.resizeHandler([&](int w, int h, StateChange /*sc*/)
 		{
-			ResizeTables(w-32, h-32);
+			resizeTo = Size2D{w-32, h-32};
 			printf("Resize: %i %i\n", w, h);
 		} );
 		wnd.idleHandler([&]
 		{
-            auto t0 = std::chrono::high_resolution_clock::now();
-			table[1 - idx].parallel_fill2([&t = table[idx]](int x, int y)->char
+			//Pinned before the tables are first touched.
+			if(!pinned){ pool.pin(0); pinned = true; }
+			if(resizeTo.w >= 0 || (restored && table[1].size() != table[0].size()))
 			{
-				auto w = t.w;
-				auto h = t.h;
-				if(w < 1 || h < 1){ return 0; }
-				auto c = t(x, y);
-				auto xp1 = x == w-1 ? 0   : x+1;
-				auto xm1 = x == 0   ? w-1 : x-1;
-				auto yp1 = y == h-1 ? 0   : y+1;
-				auto ym1 = y == 0   ? h-1 : y-1;
-				auto sum = t(xm1, ym1) + t(x, ym1) + t(xp1, ym1)
-					     + t(xm1, y  ) +             t(xp1, y  )
-					     + t(xm1, yp1) + t(x, yp1) + t(xp1, yp1);
-				if(c == 0 &&  sum == 3           ){ return 1; }
-				if(c == 1 && (sum < 2 || sum > 3)){ return 0; }
-				return c;
-			});
+				ResizeTables(resizeTo.w, resizeTo.h);
+				resizeTo.w = -1;
+			}
+			rule.with_kernel([&](auto const& kernel){ table[1 - idx].parallel_stencil<1>(pool, table[idx], kernel); });
 			idx = 1 - idx;
-            auto t1 = std::chrono::high_resolution_clock::now();
-            auto dt = (static_cast<std::chrono::duration<double, std::milli>>(t1-t0)).count();
-            frame_time += dt;
-            frame_count += 1;
+			generation += 1;
+			//Copy the board only as often as frames are drawn, not every generation.
+			if(frameWanted.exchange(false, std::memory_order_acq_rel)){ Publish(); }
 		});
 		wnd.exitHandler([&]{ });
 
 		wnd.renderHandler( [&](SoftwareRenderer& r)
 		{
-			r.forall_pixels([](auto, auto, auto){ return color(255, 255, 255); });
-			r.plot_by_index(16, 16, table[idx].w, table[idx].h, [&](auto x, auto y){ return table[idx](x, y) == 0 ? dead : live; });
-            if(frame_count == 200)
-            {
-                std::cout << "Average step time: " << frame_time / frame_count << std::endl;
-                frame_time = 0.0;
-                frame_count = 0;
-            }
+			snapshot.update();
+			frameWanted.store(true, std::memory_order_release);
+			auto const& t = snapshot.read_buffer();
+			r.clear(color(255, 255, 255));
+			r.plot_by_index(16, 16, t.w, t.h, [&](auto x, auto y){ return palette[(unsigned char)t(x, y)]; });
+			if(wnd.frame % 200 == 199)
+			{
+				auto const& st = wnd.window.stats;
+				auto now = std::chrono::steady_clock::now();
+				long steps = wnd.steps.load();
+				double dt = std::chrono::duration<double>(now - last_report).count();
+				printf("%.1f steps/s, render p50 %.3f ms, upload p50 %.3f ms, %.1f fps, %ld missed frames\n",
+					(steps - last_steps) / dt, st.p50(FrameStats::Render), st.p50(FrameStats::Upload), st.fps(), wnd.window.pacer.missed);
+				last_steps = steps; last_report = now;
+			}
 		});
 
 		bool res = wnd.open(L"C++ App", {42, 64}, {640, 480}, true, [&]{ return true; });
@@ -187,8 +192,14 @@ struct App
 //#ifdef _WIN32
 //int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow)
 //#else
-int main()
+int main(int argc, char** argv)
 //#endif
 {
-	return App{}.enterApp();
+	//The rule as B/S, S/B or Generations string, e.g. B36/S23 or B2/S/C3, the checkpoint file and a pattern file.
+	const Rule rule = Rule::parse(argc > 1 ? argv[1] : "B3/S23");
+	if(!rule.valid){ printf("Usage: %s [rule [checkpoint [pattern.rle|.mc]]], e.g. B3/S23, 23/3 or B2/S/C3\n", argv[0]); return 1; }
+	printf("Rule %s\n", rule.str().c_str());
+	App app{rule, argc > 2 ? argv[2] : "", argc > 3 ? argv[3] : ""};
+	if(!app.Restore()){ app.LoadPattern(); }
+	return app.enterApp();
 }
\ No newline at end of file
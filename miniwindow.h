@@ -8,6 +8,22 @@
 #include <chrono>
 #include <functional>
 #include <cmath>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MINIWND_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -17,21 +33,100 @@
 #include <Windowsx.h>
 
 #else
+//MINIWND_HEADLESS leaves out MainWindow and with it X11, HeadlessWindow and the rest build on POSIX alone.
+#ifndef MINIWND_HEADLESS
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/XKBlib.h>
 #include <X11/Xutil.h>
+//MIT-SHM is optional, build with MINIWND_NO_XSHM where libXext is missing and frames go through XPutImage.
+#ifndef MINIWND_NO_XSHM
+#include <X11/extensions/XShm.h>
+#endif
+#endif
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
 
 std::string to_utf8_string(std::wstring const& wstr){ return std::wstring_convert<std::codecvt_utf8<wchar_t>>{}.to_bytes(wstr); }
 
 #endif
 
+#include "storage.h"
+#include "threadpool.h"
+
 struct Pos2D{ int x, y; };
 
 struct Size2D{ int w, h; int area() const { return w*h; } };
 
 template<typename T> struct Point{ T x, y; };
 
+//Half-open pixel rectangle [x0, x1) x [y0, y1).
+struct Rect2D
+{
+	int x0, y0, x1, y1;
+	int w() const { return x1 - x0; }
+	int h() const { return y1 - y0; }
+	long long area() const { return empty() ? 0 : (long long)w() * (long long)h(); }
+	bool empty() const { return x1 <= x0 || y1 <= y0; }
+	bool contains(Rect2D const& r) const { return x0 <= r.x0 && y0 <= r.y0 && r.x1 <= x1 && r.y1 <= y1; }
+};
+
+inline Rect2D bounding(Rect2D const& a, Rect2D const& b){ return Rect2D{std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1)}; }
+
+//A small set of rectangles covering everything drawn since the last clear. Rectangles are merged when that
+//wastes little area, and the cheapest pair is merged when there are more than max_rects of them.
+struct DirtyRegion
+{
+	std::vector<Rect2D> rects;
+	size_t max_rects;
+	bool full;
+
+	DirtyRegion():rects{}, max_rects{8}, full{true}{}
+
+	void clear(){ rects.clear(); full = false; }
+	void invalidate(){ rects.clear(); full = true; }
+	bool empty() const { return !full && rects.empty(); }
+
+	void add(Rect2D r)
+	{
+		if(full || r.empty()){ return; }
+		for(auto const& e : rects){ if(e.contains(r)){ return; } }
+		for(size_t i=0; i<rects.size(); )
+		{
+			auto u = bounding(rects[i], r);
+			auto used = rects[i].area() + r.area();
+			if(u.area() <= used + std::max(1024ll, used / 4))
+			{
+				r = u;
+				rects[i] = rects.back(); rects.pop_back();
+				i = 0;
+			}
+			else{ ++i; }
+		}
+		rects.push_back(r);
+		while(rects.size() > max_rects)
+		{
+			size_t bi = 0, bj = 1;
+			long long best = -1;
+			for(size_t i=0; i<rects.size(); ++i)
+			{
+				for(size_t j=i+1; j<rects.size(); ++j)
+				{
+					auto waste = bounding(rects[i], rects[j]).area() - rects[i].area() - rects[j].area();
+					if(best < 0 || waste < best){ best = waste; bi = i; bj = j; }
+				}
+			}
+			rects[bi] = bounding(rects[bi], rects[bj]);
+			rects[bj] = rects.back(); rects.pop_back();
+		}
+	}
+};
+
 struct Color
 {
 	unsigned char b, g, r, a;
@@ -47,7 +142,7 @@ unsigned long packed_color(Color const& c){ return ((((unsigned long)c.a*256 + (
 
 struct Image2D
 {
-	std::vector<Color> data;
+	Storage<Color> data;
 	int w, h;
 
 	Image2D():data{}, w{0}, h{0}{}
@@ -58,6 +153,12 @@ struct Image2D
 		w = w_; h = h_;
 	}
 
+	void attach(Color* p, int w_, int h_)
+	{
+		data.attach(p, (size_t)w_ * (size_t)h_);
+		w = w_; h = h_;
+	}
+
 	Color      & operator()(int x, int y)      { return data[(size_t)y*(size_t)w+(size_t)x]; }
 	Color const& operator()(int x, int y)const { return data[(size_t)y*(size_t)w+(size_t)x]; }
 };
@@ -94,6 +195,14 @@ namespace MainWindowDetails
 		void mouse_middle_up(         ){ mouse.middle = false;     mouse_trigger(Mouse::MiddleUp  ); }
 		void mouse_right_down(        ){ mouse.right = true;       mouse_trigger(Mouse::RightDown ); }
 		void mouse_right_up(          ){ mouse.right = false;      mouse_trigger(Mouse::RightUp   ); }
+
+#ifdef _WIN32
+		bool resizeEnded = false;  //an interactive move or resize finished, the frame schedule starts over
+#else
+		int  shmCompletion = -1;   //event type of MIT-SHM completion events, -1 if the extension is not in use
+		bool shmPending = false;   //an XShmPutImage is still reading the shared backbuffer
+		bool exposed = false;      //the server lost window contents, present everything on the next render
+#endif
 	};
 	/*inline*/ ProcRelay relay;
 
@@ -121,6 +230,7 @@ namespace MainWindowDetails
 
 		case WM_ERASEBKGND:  return 1;
 		case WM_SIZE:        relay.onResize(LOWORD(lParam), HIWORD(lParam), fromWPARAM(wParam)); break;
+		case WM_EXITSIZEMOVE: relay.resizeEnded = true;                                  break;
 
 		case WM_CLOSE:     relay.onExit();   break;
 		case WM_PAINT:     relay.onRender(); break;
@@ -128,7 +238,7 @@ namespace MainWindowDetails
 		}
 		return 0;
 	}
-#else
+#elif !defined(MINIWND_HEADLESS)
 	static void Proc(Display* /*display*/, Window& /*handle*/, XEvent e, Size2D const& size, bool& isResizing)
 	{
 		switch(e.type)
@@ -189,12 +299,292 @@ namespace MainWindowDetails
 			break;
 		}
 		//CM handled outside.
-		case Expose: relay.onRender(); break;
+		case Expose: relay.exposed = relay.exposed || !e.xexpose.send_event; relay.onRender(); break;
+		default:
+			if(e.type == relay.shmCompletion){ relay.shmPending = false; }
+			break;
 		}
 	}
+
+	static Bool isShmCompletion(Display* /*display*/, XEvent* e, XPointer /*arg*/){ return e->type == relay.shmCompletion ? True : False; }
+
+#ifndef MINIWND_NO_XSHM
+	static bool xerrorTrapped = false;
+	static int trapXError(Display* /*display*/, XErrorEvent* /*e*/){ xerrorTrapped = true; return 0; }
+#endif
 #endif
 }
 
+//Durations of the phases of the last frames, kept in a ring buffer that other threads can query while the loop
+//writes it. Nothing is measured until enable() is called, the disabled cost is a flag test per phase. The ring is
+//allocated by the first enable() and kept until destruction, so readers never see it freed; call that first enable()
+//before other threads start querying.
+//Time spent in nested phases (e.g. a render triggered while draining events) is only counted for the inner one.
+struct FrameStats
+{
+	enum Phase{ Events, Step, Render, Upload, Present, Frame, Count };
+	static const size_t capacity = 1024;
+
+	using clock = std::chrono::steady_clock;
+	struct Ring
+	{
+		std::array<std::array<std::atomic<long long>, Count>, capacity> ns;
+		std::array<std::atomic<long long>, capacity> stamp;
+		std::atomic<unsigned long long> frames;
+		std::array<long long, Count> current;
+		long long nested, last;
+	};
+	struct Mark{ clock::time_point t0; long long nested; };
+
+	std::unique_ptr<Ring> ring;
+	std::atomic<bool> recording;
+
+	FrameStats():ring{}, recording{false}{}
+
+	//Disabling only stops recording, the frames so far stay queryable.
+	void enable(bool on = true)
+	{
+		if(!on){ recording.store(false); return; }
+		if(recording.load()){ return; }
+		if(!ring)
+		{
+			ring = std::make_unique<Ring>();
+			for(auto& f : ring->ns){ for(auto& v : f){ v.store(0, std::memory_order_relaxed); } }
+			for(auto& v : ring->stamp){ v.store(0, std::memory_order_relaxed); }
+			ring->frames.store(0);
+		}
+		//The first frame after a pause has no interval.
+		ring->current.fill(0);
+		ring->nested = 0;
+		ring->last = 0;
+		recording.store(true);
+	}
+	bool enabled() const { return recording.load(std::memory_order_relaxed); }
+
+	Mark begin() const { return enabled() ? Mark{clock::now(), ring->nested} : Mark{}; }
+
+	void end(Phase p, Mark const& m)
+	{
+		//Phases begun while disabled are not counted.
+		if(!enabled() || m.t0 == clock::time_point{}){ return; }
+		long long dt = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m.t0).count();
+		long long inner = ring->nested - m.nested;
+		ring->current[p] += dt - inner;
+		ring->nested += dt - inner;
+	}
+
+	//Closes the current frame.
+	void commit()
+	{
+		if(!enabled()){ return; }
+		auto& r = *ring;
+		long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+		r.current[Frame] = r.last ? now - r.last : 0;
+		r.last = now;
+		auto n = r.frames.load(std::memory_order_relaxed);
+		auto i = n % capacity;
+		for(int p=0; p<Count; ++p){ r.ns[i][p].store(r.current[p], std::memory_order_relaxed); }
+		r.stamp[i].store(now, std::memory_order_relaxed);
+		r.frames.store(n + 1, std::memory_order_release);
+		r.current.fill(0);
+	}
+
+	unsigned long long frames() const { return ring ? ring->frames.load(std::memory_order_acquire) : 0; }
+
+	//The q-quantile (0..1) of a phase over the frames in the ring, in milliseconds.
+	double percentile(Phase p, double q) const
+	{
+		auto v = samples(p);
+		if(v.empty()){ return 0.0; }
+		q = std::min(std::max(q, 0.0), 1.0);
+		auto k = (size_t)(q * (double)(v.size() - 1) + 0.5);
+		std::nth_element(v.begin(), v.begin() + k, v.end());
+		return v[k] * 1e-6;
+	}
+	double p50(Phase p) const { return percentile(p, 0.50); }
+	double p95(Phase p) const { return percentile(p, 0.95); }
+	double p99(Phase p) const { return percentile(p, 0.99); }
+	double max(Phase p) const { auto v = samples(p); return v.empty() ? 0.0 : *std::max_element(v.begin(), v.end()) * 1e-6; }
+
+	//Frames per second over the last second, or over the whole ring if it covers less.
+	double fps() const
+	{
+		auto n = frames();
+		if(n < 2){ return 0.0; }
+		auto& r = *ring;
+		auto m = std::min<unsigned long long>(n, capacity);
+		long long newest = r.stamp[(n - 1) % capacity].load(std::memory_order_relaxed);
+		unsigned long long k = 1;
+		long long oldest = newest;
+		for(; k < m; ++k)
+		{
+			long long t = r.stamp[(n - 1 - k) % capacity].load(std::memory_order_relaxed);
+			oldest = t;
+			if(newest - t >= 1000000000ll){ break; }
+		}
+		if(k == m){ k -= 1; }
+		return newest > oldest ? (double)k / ((newest - oldest) * 1e-9) : 0.0;
+	}
+
+	std::vector<long long> samples(Phase p) const
+	{
+		std::vector<long long> v;
+		auto n = frames();
+		auto m = std::min<unsigned long long>(n, capacity);
+		v.reserve(m);
+		for(unsigned long long k=0; k<m; ++k){ v.push_back(ring->ns[(n - 1 - k) % capacity][p].load(std::memory_order_relaxed)); }
+		if(p == Frame && !v.empty() && n <= capacity){ v.pop_back(); } //The first frame has no interval.
+		return v;
+	}
+};
+
+//Frame pacing for the non event driven loop: frames are due every 1/targetFps seconds (or on every iteration if
+//targetFps is 0). With adaptiveSteps the time until the next deadline is filled with as many steps as are
+//estimated to fit, otherwise there is one step per frame. Frames finishing after the following deadline count as missed.
+struct FramePacer
+{
+	using clock = std::chrono::steady_clock;
+
+	double targetFps;
+	bool adaptiveSteps;
+	int maxStepsPerFrame;
+	long frames, missed;
+	int steps;                   //Steps since the last frame.
+	double stepTime, renderTime; //Moving averages in seconds.
+	clock::time_point deadline;
+	bool started;
+
+	FramePacer():targetFps{0.0}, adaptiveSteps{false}, maxStepsPerFrame{1000}, frames{0}, missed{0}, steps{0}, stepTime{0.0}, renderTime{0.0}, deadline{}, started{false}{}
+
+	clock::duration period() const { return targetFps > 0.0 ? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / targetFps)) : clock::duration::zero(); }
+
+	bool due(clock::time_point now)
+	{
+		if(!started){ deadline = now; started = true; }
+		return targetFps <= 0.0 || now >= deadline;
+	}
+
+	bool can_step(clock::time_point now) const
+	{
+		return adaptiveSteps && steps < maxStepsPerFrame && now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(stepTime + renderTime)) < deadline;
+	}
+
+	clock::duration until_due(clock::time_point now) const { return targetFps > 0.0 && deadline > now ? deadline - now : clock::duration::zero(); }
+
+	//Start a new schedule from the next frame, e.g. after a pause, so the frames not shown meanwhile are not counted as missed.
+	void restart(){ started = false; steps = 0; }
+
+	template<typename F>
+	void step(F&& f)
+	{
+		auto t0 = clock::now();
+		f();
+		stepTime = average(stepTime, clock::now() - t0);
+		steps += 1;
+	}
+
+	template<typename F>
+	void render(F&& f)
+	{
+		auto t0 = clock::now();
+		f();
+		auto now = clock::now();
+		renderTime = average(renderTime, now - t0);
+		steps = 0;
+		frames += 1;
+		if(targetFps > 0.0)
+		{
+			auto T = period();
+			deadline += T;
+			if(now >= deadline)
+			{
+				auto behind = (now - deadline) / T + 1;
+				missed += (long)behind;
+				deadline += behind * T;
+			}
+		}
+	}
+
+	static double average(double avg, clock::duration dt)
+	{
+		double t = std::chrono::duration<double>(dt).count();
+		return avg == 0.0 ? t : 0.9 * avg + 0.1 * t;
+	}
+};
+
+//Tasks posted from any thread and run by the loop thread. Producers push onto a lock-free stack,
+//the consumer takes the whole stack with one exchange and runs it in posting order.
+struct TaskQueue
+{
+	struct Node{ std::function<void(void)> task; Node* next; };
+	std::atomic<Node*> head;
+
+	TaskQueue():head{nullptr}{}
+	TaskQueue(TaskQueue const&) = delete;
+	TaskQueue& operator=(TaskQueue const&) = delete;
+	~TaskQueue(){ release(head.exchange(nullptr)); }
+
+	//Returns true if the queue was empty, only then the consumer needs to be woken.
+	bool push(std::function<void(void)> f)
+	{
+		auto n = new Node{std::move(f), head.load(std::memory_order_relaxed)};
+		while(!head.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)){}
+		return n->next == nullptr;
+	}
+
+	bool empty() const { return head.load(std::memory_order_relaxed) == nullptr; }
+
+	//Runs the tasks posted so far, tasks posted meanwhile are left for the next call.
+	int run()
+	{
+		Node* n = head.exchange(nullptr, std::memory_order_acquire);
+		if(!n){ return 0; }
+		Node* fifo = nullptr;
+		while(n){ auto next = n->next; n->next = fifo; fifo = n; n = next; }
+		int count = 0;
+		while(fifo)
+		{
+			fifo->task();
+			auto next = fifo->next;
+			delete fifo;
+			fifo = next;
+			count += 1;
+		}
+		return count;
+	}
+
+	static void release(Node* n){ while(n){ auto next = n->next; delete n; n = next; } }
+};
+
+//Lock-free handoff of the latest complete state from one writer thread to one reader thread. The writer fills
+//write_buffer() and publishes it, the reader calls update() and reads read_buffer(), which stays valid and unchanged
+//until its next update(). Neither side ever waits; states published faster than they are read are skipped.
+template<typename T>
+struct TripleBuffer
+{
+	enum : int { Index = 3, Fresh = 4 };
+	std::array<T, 3> slots;
+	std::atomic<int> middle; //Index of the slot in between, with Fresh set if it was published after the last update().
+	int back, front;
+
+	TripleBuffer():slots{}, middle{1}, back{0}, front{2}{}
+	TripleBuffer(TripleBuffer const&) = delete;
+	TripleBuffer& operator=(TripleBuffer const&) = delete;
+
+	T& write_buffer(){ return slots[back]; }
+	void publish(){ back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & Index; }
+
+	//Switches to the last published state, returns false if there is none since the last call.
+	bool update()
+	{
+		if((middle.load(std::memory_order_relaxed) & Fresh) == 0){ return false; }
+		front = middle.exchange(front, std::memory_order_acq_rel) & Index;
+		return true;
+	}
+	T const& read_buffer() const { return slots[front]; }
+};
+
+#ifndef MINIWND_HEADLESS
 struct PlatformWindowData
 {
 	enum State{ Invalid, Normal, Minimized, Maximized, Hidden, Fullscreen };
@@ -203,6 +593,10 @@ struct PlatformWindowData
 	Size2D size, last_size;
 	State state, last_state;
 	std::wstring title;
+	FrameStats stats; //Per-phase frame timings, call stats.enable() to start measuring.
+	FramePacer pacer; //Target frame rate and step budget when not event driven.
+	std::atomic<bool> paused; //Not event driven, but neither steps nor frames: the loop sleeps until an event, a watched handle or redraw(). Also holds the asyncStep thread.
+	TaskQueue tasks;  //Filled by post(), run once per loop iteration.
 	
 #ifdef _WIN32
 	WNDCLASSW wc;
@@ -211,7 +605,50 @@ struct PlatformWindowData
 	HWND handle;
 	HICON icon;
 	bool eventDriven;
-	PlatformWindowData():handle{nullptr}, eventDriven{true}, state{State::Invalid}, last_state{State::Invalid}{}
+	std::vector<HANDLE> watched;
+	std::vector<std::function<void(HANDLE)>> watchHandlers;
+	PlatformWindowData():paused{false}, handle{nullptr}, eventDriven{true}, state{State::Invalid}, last_state{State::Invalid}{}
+
+	//Run f on the loop thread. Safe to call from any thread while the window is open.
+	void post(std::function<void(void)> f)
+	{
+		if(tasks.push(std::move(f)) && handle){ PostMessage(handle, WM_APP, 0, 0); }
+	}
+
+	//Call f(h) from the loop whenever the waitable handle h (event, waitable timer, ...) is signaled.
+	//At most MAXIMUM_WAIT_OBJECTS-1 handles can be watched.
+	bool watch(HANDLE h, std::function<void(HANDLE)> f)
+	{
+		if(watched.size() + 1 >= MAXIMUM_WAIT_OBJECTS){ return false; }
+		unwatch(h);
+		watched.push_back(h);
+		watchHandlers.push_back(std::move(f));
+		return true;
+	}
+
+	void unwatch(HANDLE h)
+	{
+		for(size_t i=0; i<watched.size(); ++i)
+		{
+			if(watched[i] == h){ watched.erase(watched.begin()+i); watchHandlers.erase(watchHandlers.begin()+i); return; }
+		}
+	}
+
+	//Block until a message arrives, a watched handle is signaled or the timeout expires.
+	void wait(FramePacer::clock::duration timeout)
+	{
+		using namespace std::chrono;
+		auto ms = duration_cast<milliseconds>(timeout);
+		if(ms < timeout){ ms += milliseconds(1); }
+		DWORD t = timeout < FramePacer::clock::duration::zero() || ms.count() >= (long long)INFINITE ? INFINITE : (DWORD)ms.count();
+		auto res = MsgWaitForMultipleObjects((DWORD)watched.size(), watched.data(), FALSE, t, QS_ALLINPUT);
+		if(res >= WAIT_OBJECT_0 && res < WAIT_OBJECT_0 + watched.size())
+		{
+			auto h = watched[res - WAIT_OBJECT_0];
+			auto f = watchHandlers[res - WAIT_OBJECT_0];
+			f(h);
+		}
+	}
 
 	bool open(std::wstring const& title_, Pos2D pos_, Size2D size_, bool Decorated_/*, bool FullScreen_*/)
 	{
@@ -303,13 +740,18 @@ struct PlatformWindowData
 		{
 			if( eventDriven )
 			{
-				if( GetMessage(&msg, 0, 0, 0) < 0 ){ close(); }
+				if( PeekMessage(&msg, 0, 0, 0, PM_REMOVE) == 0 ){ wait(FramePacer::clock::duration::max()); continue; }
 				{
+					auto te = stats.begin();
 					TranslateMessage( &msg );
 					DispatchMessage( &msg );
+					tasks.run();
+					stats.end(FrameStats::Events, te);
 					if(msg.message == WM_QUIT){ break; }
 				}
+				auto ts = stats.begin();
 				step();
+				stats.end(FrameStats::Step, ts);
 				if(msg.time - last_time > 100)
 				{
 					redraw();
@@ -318,6 +760,7 @@ struct PlatformWindowData
 			}
 			else
 			{
+				auto te = stats.begin();
 				while( PeekMessage(&msg, 0, 0, 0, PM_REMOVE) != 0 )
 				{
 					TranslateMessage( &msg );
@@ -325,14 +768,33 @@ struct PlatformWindowData
 					if(msg.message == WM_QUIT){ break; }
 					
 				}
+				tasks.run();
+				stats.end(FrameStats::Events, te);
 				if(msg.message == WM_QUIT){ break; }
-				step();
-				//++last_time;
-				//if(last_time > 2)
+				//The modal size loop held up the schedule, the frames skipped meanwhile are not missed.
+				if(MainWindowDetails::relay.resizeEnded){ MainWindowDetails::relay.resizeEnded = false; pacer.restart(); }
+				if(paused)
 				{
-					redraw();
-					//last_time = 0;
+					//Invalidated areas are still painted through WM_PAINT.
+					pacer.restart();
+					wait(FramePacer::clock::duration::max());
+					continue;
+				}
+				auto paced_step = [&]
+				{
+					auto ts = stats.begin();
+					pacer.step(step);
+					stats.end(FrameStats::Step, ts);
+				};
+				auto now = FramePacer::clock::now();
+				if(pacer.due(now))
+				{
+					if(pacer.steps == 0){ paced_step(); }
+					//Paint synchronously, so the pacer sees the render time.
+					pacer.render([&]{ RedrawWindow(handle, 0, 0, RDW_ERASE|RDW_INVALIDATE|RDW_UPDATENOW); });
 				}
+				else if(pacer.can_step(now)){ paced_step(); }
+				else{ wait(pacer.until_due(now)); }
 			}
 		}
 	}
@@ -386,7 +848,59 @@ struct PlatformWindowData
 	Window handle;
 	Atom AWM_DELETE_WINDOW, AWM_PROTOCOLS;
 	bool eventDriven, needRedraw, isResizing, isQuit;
-	PlatformWindowData():display{nullptr}, visual{nullptr}, screen{0}, eventDriven{true}, needRedraw{false}, isResizing{false}, isQuit{true}{}
+	struct Watch{ int fd; short events; std::function<void(int, short)> handler; };
+	std::vector<Watch> watches;
+	std::vector<pollfd> pollfds;
+	int wakePipe[2]; //Written by post() to interrupt poll.
+	PlatformWindowData():paused{false}, display{nullptr}, visual{nullptr}, screen{0}, eventDriven{true}, needRedraw{false}, isResizing{false}, isQuit{true}, wakePipe{-1, -1}{}
+
+	//Run f on the loop thread. Safe to call from any thread while the window is open.
+	void post(std::function<void(void)> f)
+	{
+		if(tasks.push(std::move(f)) && wakePipe[1] >= 0)
+		{
+			char b = 0;
+			while(write(wakePipe[1], &b, 1) < 0 && errno == EINTR){}
+		}
+	}
+
+	//Call f(fd, revents) from the loop whenever poll reports one of the events (POLLIN, POLLOUT, ...) on fd.
+	//Any pollable descriptor works: eventfd, timerfd, pipes, sockets.
+	void watch(int fd, short events, std::function<void(int, short)> f)
+	{
+		unwatch(fd);
+		watches.push_back(Watch{fd, events, std::move(f)});
+	}
+
+	void unwatch(int fd)
+	{
+		watches.erase(std::remove_if(watches.begin(), watches.end(), [=](Watch const& w){ return w.fd == fd; }), watches.end());
+	}
+
+	//Block until X events are queued, a watched descriptor is ready or the timeout expires.
+	void wait(FramePacer::clock::duration timeout)
+	{
+		using namespace std::chrono;
+		if(XEventsQueued(display, QueuedAfterFlush) > 0){ return; }
+		pollfds.clear();
+		pollfds.push_back(pollfd{ConnectionNumber(display), POLLIN, 0});
+		for(auto const& w : watches){ pollfds.push_back(pollfd{w.fd, w.events, 0}); }
+
+		//Round up, waking early would only spin until the deadline.
+		auto ms = duration_cast<milliseconds>(timeout);
+		if(ms < timeout){ ms += milliseconds(1); }
+		int t = timeout < FramePacer::clock::duration::zero() || ms.count() > 0x7FFFFFFF ? -1 : (int)ms.count();
+		if(poll(pollfds.data(), (nfds_t)pollfds.size(), t) <= 0){ return; }
+		for(size_t i=1; i<pollfds.size(); ++i)
+		{
+			if(pollfds[i].revents == 0){ continue; }
+			//A handler may watch or unwatch, so look it up again and call a copy.
+			auto it = std::find_if(watches.begin(), watches.end(), [&](Watch const& w){ return w.fd == pollfds[i].fd; });
+			if(it == watches.end()){ continue; }
+			auto f = it->handler;
+			f(pollfds[i].fd, pollfds[i].revents);
+		}
+	}
 
 	bool rename(std::wstring const& name)
 	{
@@ -457,6 +971,14 @@ struct PlatformWindowData
 		AWM_DELETE_WINDOW = XInternAtom(display, "WM_DELETE_WINDOW", False);
 		XSetWMProtocols(display, handle, &AWM_DELETE_WINDOW, 1);
 
+		if(pipe(wakePipe) == 0)
+		{
+			for(int fd : wakePipe){ fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); fcntl(fd, F_SETFD, FD_CLOEXEC); }
+			//Drain before the tasks run, so a post() racing with the drain still leaves a byte for the next poll.
+			watch(wakePipe[0], POLLIN, [](int fd, short){ char b[64]; while(read(fd, b, sizeof(b)) > 0){} });
+		}
+		else{ printf("Cannot create the wakeup pipe, post() will not interrupt the loop.\n"); wakePipe[0] = wakePipe[1] = -1; }
+
 		if(!Decorated_)
 		{
 			struct Hints
@@ -477,19 +999,28 @@ struct PlatformWindowData
 	template<typename F>
 	void loop(F&& step)
 	{
-		auto t0 = std::chrono::high_resolution_clock::now();
-		auto t1 = t0, trsz = t0;
+		using clock = FramePacer::clock;
+		auto trsz = clock::now(), tframe = trsz;
 		printf("Entering event loop\n");
-		long nredraw = 0, nredrawproc = 0;
 
-		auto sendExposeEvent = [&]()
+		auto paced_step = [&]
 		{
-			XExposeEvent xee{};
-			xee.type = Expose;
-			xee.send_event = True;
-			xee.display = display;
-			xee.window = handle;
-			XSendEvent(display, handle, False, NoEventMask, (XEvent*)&xee);
+			auto ts = stats.begin();
+			pacer.step(step);
+			stats.end(FrameStats::Step, ts);
+		};
+		auto render = [&]
+		{
+			pacer.render([&]{ MainWindowDetails::relay.onRender(); });
+			needRedraw = false;
+			tframe = clock::now();
+		};
+		//Frames outside the schedule, requested by redraw().
+		auto render_now = [&]
+		{
+			MainWindowDetails::relay.onRender();
+			needRedraw = false;
+			tframe = clock::now();
 		};
 
 		//Reposition the window, because some WMs move the window initially despite the x, y, set in create window.
@@ -499,82 +1030,71 @@ struct PlatformWindowData
 			XEvent e;
 			if(eventDriven)
 			{
+				tasks.run();
+				if(XEventsQueued(display, QueuedAfterFlush) == 0)
+				{
+					if(needRedraw){ render_now(); }
+					else{ wait(clock::duration::max()); }
+					continue;
+				}
 				XNextEvent(display, &e);
+				auto te = stats.begin();
 				if(e.type == ClientMessage && e.xclient.message_type == AWM_PROTOCOLS && (Atom)(e.xclient.data.l[0]) == AWM_DELETE_WINDOW){ isQuit = true; MainWindowDetails::relay.onExit(); break; }
 				else{ MainWindowDetails::Proc(display, handle, e, size, isResizing); }
+				stats.end(FrameStats::Events, te);
 				//step();
 				//printf("while 1\n");
-				needRedraw = true;
 			}
 			else
 			{
-				//auto res = True;
-				//while(res == True && !isQuit)
+				auto te = stats.begin();
+				while(XEventsQueued(display, QueuedAfterFlush) > 0)
 				{
-					while(XEventsQueued(display, QueuedAlready) > 0)
+					XNextEvent(display, &e);
+					if(e.type == ClientMessage)
 					{
-						XNextEvent(display, &e);
-						if(e.type == ClientMessage)
-						{
-							if(e.xclient.send_event){ /*printf("[%zi] Sent CM ", e.xclient.serial);*/ }
-							else{ printf("[%zi] Not sent CM ", e.xclient.serial); }
-
-							if(e.xclient.message_type == AWM_PROTOCOLS)
-							{
-								//printf("WM_PROTOCOLS ");
-								if( (Atom)(e.xclient.data.l[0]) == AWM_DELETE_WINDOW){ /*printf("AWM_DELETE_WINDOW\n");*/ isQuit = true; MainWindowDetails::relay.onExit(); break; }
-								else{ printf("Unknown protocol message %zi\n", e.xclient.data.l[0]); }
-							}
-							else if(e.xclient.message_type == 424242){ nredrawproc = e.xclient.data.l[0]; /*printf("Redraw processed: %zi\n", nredrawproc);*/ }
-							else{ printf("Other Atom %zi ", e.xclient.message_type); }
-						}
-						else
+						if(e.xclient.message_type == AWM_PROTOCOLS)
 						{
-							bool wasResize = false;
-							MainWindowDetails::Proc(display, handle, e, size, wasResize);
-							if(wasResize){ isResizing = true; trsz = std::chrono::high_resolution_clock::now(); }
+							if( (Atom)(e.xclient.data.l[0]) == AWM_DELETE_WINDOW){ isQuit = true; MainWindowDetails::relay.onExit(); break; }
+							else{ printf("Unknown protocol message %zi\n", e.xclient.data.l[0]); }
 						}
+						else{ printf("Other Atom %zi ", e.xclient.message_type); }
+					}
+					else
+					{
+						bool wasResize = false;
+						MainWindowDetails::Proc(display, handle, e, size, wasResize);
+						if(wasResize){ isResizing = true; trsz = clock::now(); }
 					}
-					needRedraw = true;
 				}
-			}
+				tasks.run();
+				stats.end(FrameStats::Events, te);
+				if(isQuit){ break; }
 
-			if(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now()-trsz).count()/1000.0 > 300.0)
-			{
-				//printf("isResizing = false\n");
-				isResizing = false;
-				needRedraw = true;
-			}
+				auto now = clock::now();
+				//The frames skipped while resizing are not missed, the schedule starts over from the next one.
+				if(isResizing && now - trsz > std::chrono::milliseconds(300)){ isResizing = false; pacer.restart(); }
 
-			if(needRedraw)
-			{
-				double limit = (isResizing || eventDriven) ? 250.0 : 1.0;
-				t1 = std::chrono::high_resolution_clock::now();
-				auto dt = std::chrono::duration_cast<std::chrono::microseconds>(t1-t0).count()/1000.0;
-				if(dt > limit)
+				if(paused)
 				{
-					if(eventDriven){ /*printf("limited redraw, expose event, dt = %f\n", dt); sendExposeEvent();*//*XClearArea(display, handle, 0, 0, 1, 1, true);*/ }
-					else if(!eventDriven && (nredraw == nredrawproc))
-					{
-						step();
-						sendExposeEvent();//XClearArea(display, handle, 0, 0, 1, 1, true);
-						nredraw += 1;
-						XEvent ev{0};
-						ev.type = ClientMessage;
-						ev.xclient.format = 32;
-						ev.xclient.window = handle;
-						ev.xclient.message_type = 424242;
-						ev.xclient.data.l[0] = nredraw;
-						XSendEvent(display, handle, False, NoEventMask, &ev);
-						XSync(display, False);
-						//XFlush(display);
-					}
-					t0 = t1;
-					needRedraw = false;
+					pacer.restart();
+					if(needRedraw){ render_now(); }
+					else{ wait(clock::duration::max()); }
+				}
+				else if(isResizing)
+				{
+					//Keep up with the window size at a few frames per second only, outside the schedule.
+					if(now - tframe > std::chrono::milliseconds(250)){ paced_step(); render_now(); }
+					else{ wait(std::min(tframe + std::chrono::milliseconds(250), trsz + std::chrono::milliseconds(300)) - now); }
+				}
+				else if(pacer.due(now))
+				{
+					if(pacer.steps == 0){ paced_step(); }
+					render();
 				}
+				else if(pacer.can_step(now)){ paced_step(); }
+				else{ wait(pacer.until_due(now)); }
 			}
-			//
-			//
 			if(isQuit){ break; }
 		}
 	}
@@ -696,7 +1216,16 @@ struct PlatformWindowData
 		XSendEvent(display, handle, False, NoEventMask, &e);
 		XSync(display, False);
 	}
-	bool close(){ XDestroyWindow(display, handle); XCloseDisplay(display); eventDriven = true; return true; }
+	bool close()
+	{
+		if(wakePipe[0] >= 0)
+		{
+			unwatch(wakePipe[0]);
+			::close(wakePipe[0]); ::close(wakePipe[1]);
+			wakePipe[0] = wakePipe[1] = -1;
+		}
+		XDestroyWindow(display, handle); XCloseDisplay(display); eventDriven = true; return true;
+	}
 
 	void fullscreen()
 	{
@@ -761,6 +1290,7 @@ struct PlatformWindowData
 	}
 #endif
 };
+#endif
 
 bool is_finite(double x){ return std::isfinite(x); }
 bool is_finite(float x){ return std::isfinite(x); }
@@ -772,17 +1302,169 @@ bool is_finite(T x){ return true; }
 template<typename T>
 auto clamp(T x, T min, T max){ return x < min ? min : (x > max ? max : x); }
 
+//Span kernels: store one color into n consecutive pixels. The widest kernel the CPU supports is picked at runtime.
+namespace SpanDetails
+{
+	inline uint32_t pack(Color c){ uint32_t v; memcpy(&v, &c, sizeof(v)); return v; }
+
+	inline void fill_scalar(Color* dst, size_t n, Color c)
+	{
+		auto v = pack(c);
+		auto p = (unsigned char*)dst;
+		for(size_t i=0; i<n; ++i){ memcpy(p + i*4, &v, 4); }
+	}
+
+#ifdef MINIWND_X86
+	//Spans larger than this bypass the caches, a 4K backbuffer does not fit into them anyway.
+	static const size_t stream_bytes = 4u << 20;
+
+#if defined(__GNUC__) || defined(__clang__)
+	__attribute__((target("sse2")))
+#endif
+	inline void fill_sse2(Color* dst, size_t n, Color c)
+	{
+		auto p = (unsigned char*)dst;
+		auto v = pack(c);
+		while(n > 0 && ((uintptr_t)p & 15) != 0){ memcpy(p, &v, 4); p += 4; --n; }
+		const __m128i x = _mm_set1_epi32((int)v);
+		size_t i = 0;
+		if(n*4 >= stream_bytes)
+		{
+			for(; i+16<=n; i+=16)
+			{
+				_mm_stream_si128((__m128i*)(p + i*4     ), x);
+				_mm_stream_si128((__m128i*)(p + i*4 + 16), x);
+				_mm_stream_si128((__m128i*)(p + i*4 + 32), x);
+				_mm_stream_si128((__m128i*)(p + i*4 + 48), x);
+			}
+			_mm_sfence();
+		}
+		for(; i+16<=n; i+=16)
+		{
+			_mm_store_si128((__m128i*)(p + i*4     ), x);
+			_mm_store_si128((__m128i*)(p + i*4 + 16), x);
+			_mm_store_si128((__m128i*)(p + i*4 + 32), x);
+			_mm_store_si128((__m128i*)(p + i*4 + 48), x);
+		}
+		for(; i+4<=n; i+=4){ _mm_store_si128((__m128i*)(p + i*4), x); }
+		for(; i<n; ++i){ memcpy(p + i*4, &v, 4); }
+	}
+
+#if defined(__GNUC__) || defined(__clang__)
+	__attribute__((target("avx2")))
+#endif
+	inline void fill_avx2(Color* dst, size_t n, Color c)
+	{
+		auto p = (unsigned char*)dst;
+		auto v = pack(c);
+		while(n > 0 && ((uintptr_t)p & 31) != 0){ memcpy(p, &v, 4); p += 4; --n; }
+		const __m256i x = _mm256_set1_epi32((int)v);
+		size_t i = 0;
+		if(n*4 >= stream_bytes)
+		{
+			for(; i+32<=n; i+=32)
+			{
+				_mm256_stream_si256((__m256i*)(p + i*4     ), x);
+				_mm256_stream_si256((__m256i*)(p + i*4 + 32), x);
+				_mm256_stream_si256((__m256i*)(p + i*4 + 64), x);
+				_mm256_stream_si256((__m256i*)(p + i*4 + 96), x);
+			}
+			_mm_sfence();
+		}
+		for(; i+32<=n; i+=32)
+		{
+			_mm256_store_si256((__m256i*)(p + i*4     ), x);
+			_mm256_store_si256((__m256i*)(p + i*4 + 32), x);
+			_mm256_store_si256((__m256i*)(p + i*4 + 64), x);
+			_mm256_store_si256((__m256i*)(p + i*4 + 96), x);
+		}
+		for(; i+8<=n; i+=8){ _mm256_store_si256((__m256i*)(p + i*4), x); }
+		for(; i<n; ++i){ memcpy(p + i*4, &v, 4); }
+		_mm256_zeroupper();
+	}
+
+	inline bool has_avx2()
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#elif defined(_MSC_VER)
+		int r[4];
+		__cpuid(r, 0);
+		if(r[0] < 7){ return false; }
+		__cpuid(r, 1);
+		bool osxsave = (r[2] & (1 << 27)) != 0, avx = (r[2] & (1 << 28)) != 0;
+		if(!osxsave || !avx || (_xgetbv(0) & 6) != 6){ return false; }
+		__cpuidex(r, 7, 0);
+		return (r[1] & (1 << 5)) != 0;
+#else
+		return false;
+#endif
+	}
+#endif
+
+	using FillFn = void(*)(Color*, size_t, Color);
+
+	inline FillFn select_fill()
+	{
+#ifdef MINIWND_X86
+		if(has_avx2()){ return fill_avx2; }
+		return fill_sse2;
+#else
+		return fill_scalar;
+#endif
+	}
+
+	static const FillFn fill = select_fill();
+}
+
+inline void fill_span(Color* dst, size_t n, Color c){ SpanDetails::fill(dst, n, c); }
+
 struct SoftwareRenderer
 {
 	Image2D backbuffer;
+	std::unique_ptr<ThreadPool> pool;
+	Size2D tile;
+	DirtyRegion dirty; //Pixels changed since the last present, MainWindow uploads only these.
 
-	void init  (int w, int h){ backbuffer.resize(w, h); }
-	void resize(int w, int h){ printf("Renderer resize %i %i\n", w, h); backbuffer.resize(w, h); }
-	void close(){}
+	SoftwareRenderer():backbuffer{}, pool{}, tile{128, 32}, dirty{}{}
+
+	void init  (int w, int h){ backbuffer.resize(w, h); dirty.invalidate(); }
+	void resize(int w, int h){ printf("Renderer resize %i %i\n", w, h); backbuffer.resize(w, h); dirty.invalidate(); }
+
+	//Records the pixel range [x0, x1) x [y0, y1), clipped to the backbuffer, as changed.
+	void mark(int x0, int y0, int x1, int y1)
+	{
+		dirty.add(Rect2D{std::max(x0, 0), std::max(y0, 0), std::min(x1, backbuffer.w), std::min(y1, backbuffer.h)});
+	}
+	void close(){ pool.reset(); }
+
+	//Opt-in: forall_pixels, plot_by_index and filledrect split their work into tiles of tile.w x tile.h pixels
+	//and run them on n_threads threads. The functors passed to these must be safe to call concurrently then.
+	void threads(int n_threads){ pool = n_threads > 1 ? std::make_unique<ThreadPool>(n_threads) : nullptr; }
+	int  threads() const { return pool ? pool->size() : 1; }
+
+	//Calls f(x0, y0, x1, y1) on the half-open pixel range [x0, x1) x [y0, y1), tiled and in parallel when enabled.
+	template<typename F>
+	void for_tiles(int x0, int y0, int x1, int y1, F&& f)
+	{
+		if(x1 <= x0 || y1 <= y0){ return; }
+		if(!pool){ f(x0, y0, x1, y1); return; }
+		const int tw = std::max(tile.w, 1);
+		const int th = std::max(tile.h, 1);
+		const int nx = (x1 - x0 + tw - 1) / tw;
+		const int ny = (y1 - y0 + th - 1) / th;
+		pool->parallel_for(nx * ny, [&](int t)
+		{
+			const int tx = x0 + (t % nx) * tw;
+			const int ty = y0 + (t / nx) * th;
+			f(tx, ty, std::min(tx + tw, x1), std::min(ty + th, y1));
+		});
+	}
 
 	void setpixel(int x, int y, Color c)
 	{
-		if(clamp(x, 0, backbuffer.w-1) == x && clamp(y, 0, backbuffer.h-1) == y){ backbuffer(x, y) = c; }
+		if(clamp(x, 0, backbuffer.w-1) == x && clamp(y, 0, backbuffer.h-1) == y){ backbuffer(x, y) = c; mark(x, y, x+1, y+1); }
 	}
 
 	Color getpixel(int x, int y)
@@ -791,18 +1473,34 @@ struct SoftwareRenderer
 		else{ return Color{0, 0, 0, 0}; }
 	}
 
+	void clear(Color col)
+	{
+		dirty.invalidate();
+		if(!pool){ fill_span(backbuffer.data.data(), backbuffer.data.size(), col); return; }
+		const int w = backbuffer.w;
+		for_tiles(0, 0, w, backbuffer.h, [&](int x0, int y0, int x1, int y1)
+		{
+			if(x0 == 0 && x1 == w){ fill_span(&backbuffer(0, y0), (size_t)w * (size_t)(y1 - y0), col); return; }
+			for(int j=y0; j<y1; ++j){ fill_span(&backbuffer(x0, j), (size_t)(x1 - x0), col); }
+		});
+	}
+
 	template<typename F>
 	void forall_pixels(F&& f)
 	{
+		dirty.invalidate();
 		const int w = backbuffer.w;
-		for(int y=0; y<backbuffer.h; ++y)
+		for_tiles(0, 0, w, backbuffer.h, [&](int x0, int y0, int x1, int y1)
 		{
-			int i = y * w;
-			for(int x=0; x<w; ++x, ++i)
+			for(int y=y0; y<y1; ++y)
 			{
-				backbuffer.data[i] = f(x, y, backbuffer.data[i]);
+				size_t i = (size_t)y * (size_t)w + (size_t)x0;
+				for(int x=x0; x<x1; ++x, ++i)
+				{
+					backbuffer.data[i] = f(x, y, backbuffer.data[i]);
+				}
 			}
-		}
+		});
 	}
 
 	template<typename T, typename F>
@@ -914,16 +1612,18 @@ struct SoftwareRenderer
 		auto ymax = clamp(y+h, 0, backbuffer.h-1);
 		auto xmin = clamp(x,   0, backbuffer.w-1);
 		auto xmax = clamp(x+w, 0, backbuffer.w-1);
-		for(int j=ymin; j<ymax; ++j)
+		mark(xmin, ymin, xmax, ymax);
+		for_tiles(xmin, ymin, xmax, ymax, [&](int x0, int y0, int x1, int y1)
 		{
-			if(j - ymin >= h){ break; }
-			int k = j * backbuffer.w + xmin;
-			for(int i=xmin; i<xmax; ++i, ++k)
+			for(int j=y0; j<y1; ++j)
 			{
-				if(i - xmin >= w){ break; }
-				backbuffer.data[k] = f(i-x , j-y);
+				size_t k = (size_t)j * (size_t)backbuffer.w + (size_t)x0;
+				for(int i=x0; i<x1; ++i, ++k)
+				{
+					backbuffer.data[k] = f(i-x , j-y);
+				}
 			}
-		}
+		});
 	}
 
 	void rect(int x, int y, int w, int h, Color col)
@@ -942,19 +1642,17 @@ struct SoftwareRenderer
 		auto ymax = clamp(y+h, 0, backbuffer.h-1);
 		auto xmin = clamp(x,   0, backbuffer.w-1);
 		auto xmax = clamp(x+w, 0, backbuffer.w-1);
-		for(int j=ymin; j<=ymax; ++j)
+		mark(xmin, ymin, xmax+1, ymax+1);
+		for_tiles(xmin, ymin, xmax+1, ymax+1, [&](int x0, int y0, int x1, int y1)
 		{
-			int k = j * backbuffer.w + xmin;
-			for(int i=xmin; i<=xmax; ++i, ++k)
-			{
-				backbuffer.data[k] = col;
-			}
-		}
+			for(int j=y0; j<y1; ++j){ fill_span(&backbuffer(x0, j), (size_t)(x1 - x0), col); }
+		});
 	}
 
 	template<typename F>
 	void line(int x0, int y0, int x1, int y1, F&& f)
 	{
+		mark(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1)+1, std::max(y0, y1)+1);
 		int dx = abs(x1-x0);
 		int sx = x0 < x1 ? 1 : -1;
 		int dy = -abs(y1-y0);
@@ -962,7 +1660,7 @@ struct SoftwareRenderer
 		int err = dx + dy;
 		int e2 = 0;
 		for (;;){
-			setpixel(x0, y0, f(getpixel(x0, y0)));
+			if(clamp(x0, 0, backbuffer.w-1) == x0 && clamp(y0, 0, backbuffer.h-1) == y0){ backbuffer(x0, y0) = f(backbuffer(x0, y0)); }
 			e2 = 2*err;
 			if (e2 >= dy) {
 				if (x0 == x1) break;
@@ -975,10 +1673,36 @@ struct SoftwareRenderer
 		}
 	}
 
+	//Applies f to the pixels between x0 and x1 (inclusive, clipped) for which i(x, y) holds. When f is a Color
+	//the pixels inside are assumed to be contiguous (as for convex shapes) and filled as a single span.
 	template<typename I, typename F>
 	void hline(int x0, int x1, int y, I&& i, F&& f)
 	{
-		for(int x = std::min(x0, x1); x<=std::max(x0, x1); ++x){ if(i(x, y)){ backbuffer(x, y) = f(backbuffer(x, y)); } }
+		if(y < 0 || y >= backbuffer.h){ return; }
+		int lo = std::max(std::min(x0, x1), 0);
+		int hi = std::min(std::max(x0, x1), backbuffer.w-1);
+		mark(lo, y, hi+1, y+1);
+		if constexpr(std::is_same<std::decay_t<F>, Color>::value)
+		{
+			while(lo <= hi && !i(lo, y)){ ++lo; }
+			while(hi >= lo && !i(hi, y)){ --hi; }
+			if(lo <= hi){ fill_span(&backbuffer(lo, y), (size_t)(hi - lo + 1), f); }
+		}
+		else
+		{
+			for(int x = lo; x<=hi; ++x){ if(i(x, y)){ backbuffer(x, y) = f(backbuffer(x, y)); } }
+		}
+	}
+
+	//Solid horizontal span from x0 to x1 (inclusive), clipped to the backbuffer.
+	void hspan(int x0, int x1, int y, Color col)
+	{
+		if(y < 0 || y >= backbuffer.h){ return; }
+		int lo = std::max(std::min(x0, x1), 0);
+		int hi = std::min(std::max(x0, x1), backbuffer.w-1);
+		if(lo > hi){ return; }
+		mark(lo, y, hi + 1, y + 1);
+		fill_span(&backbuffer(lo, y), (size_t)(hi - lo + 1), col);
 	}
 
 	template<typename T, typename F>
@@ -1115,6 +1839,8 @@ struct SoftwareRenderer
 		auto ey1 = (y1 - sy) * scale + sy;
 		auto ey2 = (y2 - sy) * scale + sy;
 
+		mark((int)std::floor(std::min({ex0, ex1, ex2})), (int)std::floor(std::min({ey0, ey1, ey2})), (int)std::ceil(std::max({ex0, ex1, ex2}))+1, (int)std::ceil(std::max({ey0, ey1, ey2}))+1);
+
 		/*auto wh = [](auto ){ return bgr8(255, 255, 255); };
 		line(ex0, ey0, ex1, ey1, wh);
 		line(ex1, ey1, ex2, ey2, wh);
@@ -1138,6 +1864,7 @@ struct SoftwareRenderer
 	template<typename F>
 	void ellipse(int xm, int ym, int a, int b, F&& f)
 	{
+		mark(xm-a, ym-b, xm+a+1, ym+b+1);
 		long x = -a, y = 0; /* II. quadrant from bottom left to top right */
 		long e2 = b, dx = (1+2*x)*e2*e2; /* error increment */
 		long dy = x*x, err = dx+dy; /* error of 1.step */
@@ -1157,6 +1884,7 @@ struct SoftwareRenderer
 	}
 };
 
+#ifndef MINIWND_HEADLESS
 struct MainWindow
 {
 	PlatformWindowData	window;
@@ -1169,17 +1897,56 @@ struct MainWindow
 #else
 	GC					gc;
 	Pixmap				bmp;
+	XImage*				shmimage;
+#ifndef MINIWND_NO_XSHM
+	XShmSegmentInfo		shminfo;
+#endif
+
+	//Uploads and presents the finished frame on its own thread and X connection, while the next one is drawn.
+	struct Presenter
+	{
+		Display* display;
+		GC gc;
+		std::thread thread;
+		std::mutex m;
+		std::condition_variable cv;
+		bool busy, stop;
+		Image2D image;              //The frame being presented, swapped with the backbuffer at every frame.
+		std::vector<Rect2D> rects;
+		bool exposed;
+		Pixmap bmp;
+		Presenter():display{nullptr}, gc{0}, busy{false}, stop{false}, exposed{false}, bmp{0}{}
+	};
+	std::unique_ptr<Presenter> presenter;
 #endif
+	bool sharedMemory; //Present through MIT-SHM if the X server supports it (local connections only). Ignored on Windows.
+	bool asyncPresent; //Present from a second thread with double buffering, takes precedence over sharedMemory. Ignored on Windows.
 
 	std::function<void(void)> onAppStep, onAppExit;
 	std::function<void(int, int, StateChange)> onAppResize;
 	std::function<void(SoftwareRenderer&)> onAppRender; 
-	MainWindow():onAppStep{[]{}}, onAppExit{[]{}}, onAppResize{[](int, int, StateChange){}}, onAppRender{[](SoftwareRenderer&){}}
+	std::function<void(Image2D const&, long)> onAppFrame;
+	long frame;
+
+	//With asyncStep the idle handler runs back to back on its own thread instead of once per frame in the loop, and
+	//should publish its results e.g. through a TripleBuffer. Resize and exit handlers run between two steps, other
+	//code touching the simulation state from the loop thread can do so too by holding hold_step().
+	bool asyncStep;
+	std::atomic<long> steps; //Steps completed by the step thread.
+	std::mutex stepMutex;
+	std::atomic<bool> stepHold, stepStop;
+	std::thread stepper;
+
+	MainWindow():sharedMemory{false}, asyncPresent{false}, onAppStep{[]{}}, onAppExit{[]{}}, onAppResize{[](int, int, StateChange){}}, onAppRender{[](SoftwareRenderer&){}}, onAppFrame{[](Image2D const&, long){}}, frame{0},
+	             asyncStep{false}, steps{0}, stepHold{false}, stepStop{false}
 	{
 #ifdef _WIN32
 		hdc = 0; bmp = 0; oldbmp = 0;
 #else
-		bmp = 0;
+		bmp = 0; shmimage = nullptr;
+#ifndef MINIWND_NO_XSHM
+		shminfo = XShmSegmentInfo{};
+#endif
 #endif
 	}
 
@@ -1197,41 +1964,104 @@ struct MainWindow
 		relay.onResize = [&](int w, int h, StateChange sc){ this->onResize(w, h, sc); };
 
 		renderer.init(width(), height());
-		allocate_buffers();
 #ifdef _WIN32
 #else
 		gc = XCreateGC(window.display, window.handle, 0, 0);
+		if(asyncPresent && !start_presenter()){ printf("Cannot open a second display connection, presenting on the loop thread.\n"); }
 #endif
+		allocate_buffers();
 		onResize(width(), height(), StateChange::Resized);
 
 		if( !finit() ){ return false; }
 		window.show();
-		window.loop(onAppStep);
+		if(asyncStep)
+		{
+			//The loop only renders, filling frames with empty steps would just spin.
+			auto adaptive = window.pacer.adaptiveSteps;
+			window.pacer.adaptiveSteps = false;
+			start_stepper();
+			window.loop([]{});
+			stop_stepper();
+			window.pacer.adaptiveSteps = adaptive;
+		}
+		else{ window.loop(onAppStep); }
+#ifndef _WIN32
+		stop_presenter();
+#endif
 		renderer.close();
 		return window.close();
 	}
 
+	//Keeps the step thread waiting while the returned lock is held. Does not lock anything without asyncStep.
+	std::unique_lock<std::mutex> hold_step()
+	{
+		if(!stepper.joinable()){ return {}; }
+		stepHold = true;
+		std::unique_lock<std::mutex> lock(stepMutex);
+		stepHold = false;
+		return lock;
+	}
+
+	void start_stepper()
+	{
+		stepStop = false;
+		stepper = std::thread([this]
+		{
+			while(!stepStop.load(std::memory_order_relaxed))
+			{
+				//Let hold_step in, a mutex alone may be retaken by this thread over and over.
+				if(stepHold.load(std::memory_order_relaxed)){ std::this_thread::yield(); continue; }
+				if(window.paused.load(std::memory_order_relaxed)){ std::this_thread::sleep_for(std::chrono::milliseconds(10)); continue; }
+				std::lock_guard<std::mutex> lock(stepMutex);
+				onAppStep();
+				steps.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+
+	void stop_stepper()
+	{
+		if(!stepper.joinable()){ return; }
+		stepStop = true;
+		stepper.join();
+	}
+
 	void quit(){ window.quit(); }
+	template<typename F> void post(F&& f){ window.post(std::forward<F>(f)); } //Run f on the loop thread, callable from any thread.
 
 	template<typename F> void   exitHandler(F&& f){ onAppExit   = std::forward<F>(f); }
 	template<typename F> void   idleHandler(F&& f){ onAppStep   = std::forward<F>(f); }
 	template<typename F> void renderHandler(F&& f){ onAppRender = std::forward<F>(f); }
 	template<typename F> void resizeHandler(F&& f){ onAppResize = std::forward<F>(f); }
 	template<typename F> void  mouseHandler(F&& f){ MainWindowDetails::relay.onMouseEvent = std::forward<F>(f); }
+	template<typename F> void  frameHandler(F&& f){ onAppFrame  = std::forward<F>(f); } //f(Image2D const&, long frame), called with every finished backbuffer
 
 	void onRender()
 	{
 		//printf("OnRender\n");
+		auto& stats = window.stats;
+#ifndef _WIN32
+		auto tw = stats.begin();
+		wait_shm();
+		stats.end(FrameStats::Upload, tw);
+#endif
+		auto tr = stats.begin();
 		onAppRender(renderer);
+		onAppFrame(renderer.backbuffer, frame);
+		frame += 1;
+		stats.end(FrameStats::Render, tr);
 
 #ifdef _WIN32
 		PAINTSTRUCT ps;
 		auto paintdc = BeginPaint(window.handle, &ps);
 		
+		auto tu = stats.begin();
 		HDC     tmpdc     = CreateCompatibleDC(hdc);
 		HBITMAP tmpbmp    = CreateBitmap(width(), height(), 1, 32, renderer.backbuffer.data.data());
 		HGDIOBJ oldtmpbmp = SelectObject(tmpdc, tmpbmp);
+		stats.end(FrameStats::Upload, tu);
 		
+		auto tp = stats.begin();
 		BitBlt(paintdc, 0, 0, width(), height(), tmpdc, 0, 0, SRCCOPY);
 
 		SelectObject(tmpdc, oldtmpbmp);
@@ -1240,15 +2070,230 @@ struct MainWindow
 
 		EndPaint(window.handle, &ps);
 		//ValidateRect(window.handle, NULL);
+		stats.end(FrameStats::Present, tp);
+		renderer.dirty.clear();
+#else
+		using namespace MainWindowDetails;
+		auto display = window.display;
+		const Rect2D all{0, 0, width(), height()};
+		const bool exposed = relay.exposed;
+		relay.exposed = false;
+		//Only the rectangles touched since the last present are sent to the server.
+		auto rects = renderer.dirty.full ? std::vector<Rect2D>{all} : renderer.dirty.rects;
+		if(presenter)
+		{
+			auto& p = *presenter;
+			auto tp = stats.begin();
+			wait_presenter();
+			stats.end(FrameStats::Present, tp);
+
+			//Hand the frame over and keep drawing on the previous one, updated with the changes of this frame.
+			auto tu = stats.begin();
+			std::swap(renderer.backbuffer, p.image);
+			auto& back = renderer.backbuffer;
+			for(auto const& r : rects)
+			{
+				for(int y=r.y0; y<r.y1; ++y){ memcpy(&back(r.x0, y), &p.image(r.x0, y), (size_t)r.w() * sizeof(Color)); }
+			}
+			stats.end(FrameStats::Upload, tu);
+			if(!rects.empty() || exposed)
+			{
+				std::lock_guard<std::mutex> lock(p.m);
+				p.rects = rects;
+				p.exposed = exposed;
+				p.bmp = bmp;
+				p.busy = true;
+				p.cv.notify_all();
+			}
+		}
+#ifndef MINIWND_NO_XSHM
+		else if(shmimage)
+		{
+			//The backbuffer is the shared segment itself, the server reads it directly into the window.
+			auto tu = stats.begin();
+			if(exposed){ rects = {all}; }
+			for(size_t i=0; i<rects.size(); ++i)
+			{
+				auto const& r = rects[i];
+				XShmPutImage(display, window.handle, gc, shmimage, r.x0, r.y0, r.x0, r.y0, r.w(), r.h(), i+1 == rects.size() ? True : False);
+			}
+			relay.shmPending = !rects.empty();
+			stats.end(FrameStats::Upload, tu);
+			auto tp = stats.begin();
+			XFlush(display);
+			stats.end(FrameStats::Present, tp);
+		}
+#endif
+		else
+		{
+			auto tu = stats.begin();
+			if(!rects.empty())
+			{
+				XImage* image = XCreateImage(display, window.visual, window.depth, ZPixmap, 0, (char*)renderer.backbuffer.data.data(), width(), height(), 32, 0);
+				for(auto const& r : rects){ XPutImage(display, bmp, gc, image, r.x0, r.y0, r.x0, r.y0, r.w(), r.h()); }
+				XFree(image);
+			}
+			stats.end(FrameStats::Upload, tu);
+			auto tp = stats.begin();
+			if(exposed){ XCopyArea(display, bmp, window.handle, gc, 0, 0, width(), height(), 0, 0); }
+			else
+			{
+				for(auto const& r : rects){ XCopyArea(display, bmp, window.handle, gc, r.x0, r.y0, r.w(), r.h(), r.x0, r.y0); }
+			}
+			XFlush(display);
+			stats.end(FrameStats::Present, tp);
+		}
+		renderer.dirty.clear();
+#endif
+		stats.commit();
+	}
+
+#ifndef _WIN32
+	bool start_presenter()
+	{
+		presenter = std::make_unique<Presenter>();
+		auto& p = *presenter;
+		p.display = XOpenDisplay(DisplayString(window.display));
+		if(!p.display){ presenter.reset(); return false; }
+		p.gc = XCreateGC(p.display, window.handle, 0, 0);
+		p.thread = std::thread([this, &p]
+		{
+			std::unique_lock<std::mutex> lock(p.m);
+			while(true)
+			{
+				p.cv.wait(lock, [&]{ return p.busy || p.stop; });
+				if(!p.busy){ break; }
+				lock.unlock();
+				present(p);
+				lock.lock();
+				p.busy = false;
+				p.cv.notify_all();
+			}
+		});
+		return true;
+	}
+
+	//Runs on the presenter thread, only touches its own connection and the handed over frame.
+	void present(Presenter& p)
+	{
+		auto d = p.display;
+		auto const& img = p.image;
+		if(!p.rects.empty())
+		{
+			XImage* image = XCreateImage(d, window.visual, window.depth, ZPixmap, 0, (char*)img.data.data(), img.w, img.h, 32, 0);
+			for(auto const& r : p.rects){ XPutImage(d, p.bmp, p.gc, image, r.x0, r.y0, r.x0, r.y0, r.w(), r.h()); }
+			XFree(image);
+		}
+		if(p.exposed){ XCopyArea(d, p.bmp, window.handle, p.gc, 0, 0, img.w, img.h, 0, 0); }
+		else
+		{
+			for(auto const& r : p.rects){ XCopyArea(d, p.bmp, window.handle, p.gc, r.x0, r.y0, r.w(), r.h(), r.x0, r.y0); }
+		}
+		//Requests of the two connections are not ordered, so finish these before the loop may free the pixmap.
+		XSync(d, False);
+	}
+
+	void wait_presenter()
+	{
+		if(!presenter){ return; }
+		auto& p = *presenter;
+		std::unique_lock<std::mutex> lock(p.m);
+		p.cv.wait(lock, [&]{ return !p.busy; });
+	}
+
+	void stop_presenter()
+	{
+		if(!presenter){ return; }
+		auto& p = *presenter;
+		{
+			std::lock_guard<std::mutex> lock(p.m);
+			p.stop = true;
+			p.cv.notify_all();
+		}
+		p.thread.join();
+		XFreeGC(p.display, p.gc);
+		XCloseDisplay(p.display);
+		presenter.reset();
+	}
+
+	//Block until the server has finished reading the shared backbuffer of the previous frame.
+	void wait_shm()
+	{
+		using namespace MainWindowDetails;
+		if(!relay.shmPending){ return; }
+		XEvent e;
+		XIfEvent(window.display, &e, isShmCompletion, nullptr);
+		relay.shmPending = false;
+	}
+
+	bool allocate_shm()
+	{
+#ifdef MINIWND_NO_XSHM
+		return false;
 #else
-		XImage* image = XCreateImage(window.display, window.visual, window.depth, ZPixmap, 0, (char*)renderer.backbuffer.data.data(), width(), height(), 32, 0);
-		XPutImage(window.display, bmp, gc, image, 0, 0, 0, 0, width(), height());
-		XFree(image);
-		XCopyArea(window.display, bmp, window.handle, gc, 0, 0, width(), height(), 0, 0);
-		XFlush(window.display);
+		using namespace MainWindowDetails;
+		auto display = window.display;
+		if(!sharedMemory || presenter || width() <= 0 || height() <= 0 || !XShmQueryExtension(display)){ return false; }
+
+		shmimage = XShmCreateImage(display, window.visual, window.depth, ZPixmap, nullptr, &shminfo, width(), height());
+		if(!shmimage){ return false; }
+		if(shmimage->bits_per_pixel != 32 || shmimage->bytes_per_line != width()*4)
+		{
+			printf("MIT-SHM image layout does not match the backbuffer, falling back to XPutImage.\n");
+			XDestroyImage(shmimage); shmimage = nullptr;
+			return false;
+		}
+
+		shminfo.shmid = shmget(IPC_PRIVATE, (size_t)shmimage->bytes_per_line * (size_t)shmimage->height, IPC_CREAT | 0600);
+		if(shminfo.shmid < 0){ XDestroyImage(shmimage); shmimage = nullptr; return false; }
+		shminfo.shmaddr = shmimage->data = (char*)shmat(shminfo.shmid, nullptr, 0);
+		if(shminfo.shmaddr == (char*)-1)
+		{
+			shmctl(shminfo.shmid, IPC_RMID, nullptr);
+			shmimage->data = nullptr; XDestroyImage(shmimage); shmimage = nullptr;
+			return false;
+		}
+		shminfo.readOnly = False;
+
+		//XShmAttach fails asynchronously, e.g. on remote displays, so trap the error of this request.
+		xerrorTrapped = false;
+		auto oldHandler = XSetErrorHandler(trapXError);
+		XShmAttach(display, &shminfo);
+		XSync(display, False);
+		XSetErrorHandler(oldHandler);
+		//The segment is destroyed once both sides have detached.
+		shmctl(shminfo.shmid, IPC_RMID, nullptr);
+
+		if(xerrorTrapped)
+		{
+			printf("XShmAttach failed, falling back to XPutImage.\n");
+			shmdt(shminfo.shmaddr);
+			shmimage->data = nullptr; XDestroyImage(shmimage); shmimage = nullptr;
+			return false;
+		}
+
+		renderer.backbuffer.attach((Color*)shminfo.shmaddr, width(), height());
+		relay.shmCompletion = XShmGetEventBase(display) + ShmCompletion;
+		return true;
 #endif
 	}
 
+	void free_shm()
+	{
+		if(!shmimage){ return; }
+#ifndef MINIWND_NO_XSHM
+		wait_shm();
+		renderer.backbuffer.data.detach();
+		XShmDetach(window.display, &shminfo);
+		XSync(window.display, False);
+		shmdt(shminfo.shmaddr);
+		shmimage->data = nullptr;
+		XDestroyImage(shmimage);
+		shmimage = nullptr;
+#endif
+	}
+#endif
+
 	void allocate_buffers()
 	{
 #ifdef _WIN32
@@ -1259,6 +2304,13 @@ struct MainWindow
 		ReleaseDC(window.handle, dcw);
 #else
 		bmp = XCreatePixmap(window.display, window.handle, width(), height(), window.depth);
+		if(presenter)
+		{
+			presenter->image.resize(width(), height());
+			//The presenter's connection may only use the pixmap once the server has created it.
+			XSync(window.display, False);
+		}
+		allocate_shm();
 #endif
 	}
 
@@ -1272,6 +2324,8 @@ struct MainWindow
 			DeleteDC(hdc);
 		}
 #else
+		wait_presenter();
+		free_shm();
 		if(bmp){ XFreePixmap(window.display, bmp); }
 #endif
 	}
@@ -1279,6 +2333,7 @@ struct MainWindow
 	void onResize(int w, int h, StateChange sc)
 	{
 		//printf("resize\n");
+		auto hold = hold_step();
 		bool m = (w == width()) && (h == height());
 		if(!m && sc != StateChange::Minimized)
 		{
@@ -1300,7 +2355,314 @@ struct MainWindow
 
 	void onExit()
 	{
-		onAppExit();
+		{
+			auto hold = hold_step();
+			onAppExit();
+		}
+		quit();
+	}
+};
+#endif
+
+//Offscreen counterpart of MainWindow for servers and CI: the same handlers and SoftwareRenderer, but no connection
+//to a windowing system. Every loop iteration polls the event source, steps, renders and passes the finished frame
+//to the frame handler, either at full speed or every tick seconds.
+struct HeadlessWindow
+{
+	SoftwareRenderer renderer;
+	MainWindowDetails::ProcRelay input; //Synthetic input, e.g. input.mouse_xy(x, y) from the event source.
+	Size2D size;
+	double tick;    //Seconds between frames, 0 runs at full speed.
+	long maxFrames; //Leave the loop after this many frames, 0 runs until quit is called.
+	long frame;
+	bool isQuit;
+	FrameStats stats; //The frame handler is timed as the Present phase.
+	TaskQueue tasks;  //Filled by post(), run after the event source.
+
+	std::function<void(void)> onAppStep, onAppExit;
+	std::function<void(int, int, StateChange)> onAppResize;
+	std::function<void(SoftwareRenderer&)> onAppRender;
+	std::function<void(Image2D const&, long)> onAppFrame;
+	std::function<void(HeadlessWindow&, long)> onAppEvents;
+
+	HeadlessWindow():size{0, 0}, tick{0.0}, maxFrames{0}, frame{0}, isQuit{true}, onAppStep{[]{}}, onAppExit{[]{}}, onAppResize{[](int, int, StateChange){}},
+	                 onAppRender{[](SoftwareRenderer&){}}, onAppFrame{[](Image2D const&, long){}}, onAppEvents{[](HeadlessWindow&, long){}}{}
+
+	auto width() const { return size.w; }
+	auto height() const { return size.h; }
+
+	//Same signature as MainWindow::open, the title, position and decoration are ignored.
+	template<typename FInit>
+	bool open(std::wstring const& /*title*/, Pos2D /*pos_*/, Size2D size_, bool /*Decorated_*/, FInit&& finit)
+	{
+		size = size_;
+		renderer.init(width(), height());
+		onAppResize(width(), height(), StateChange::Resized);
+		if( !finit() ){ return false; }
+		loop();
+		renderer.close();
+		return true;
+	}
+
+	void loop()
+	{
+		isQuit = false;
+		frame = 0;
+		auto next = std::chrono::steady_clock::now();
+		while(!isQuit && (maxFrames <= 0 || frame < maxFrames))
+		{
+			auto te = stats.begin();
+			onAppEvents(*this, frame);
+			tasks.run();
+			stats.end(FrameStats::Events, te);
+			if(isQuit){ break; }
+			auto ts = stats.begin();
+			onAppStep();
+			stats.end(FrameStats::Step, ts);
+			auto tr = stats.begin();
+			onAppRender(renderer);
+			stats.end(FrameStats::Render, tr);
+			auto tp = stats.begin();
+			onAppFrame(renderer.backbuffer, frame);
+			stats.end(FrameStats::Present, tp);
+			stats.commit();
+			renderer.dirty.clear();
+			frame += 1;
+			if(tick > 0.0)
+			{
+				next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(tick));
+				std::this_thread::sleep_until(next);
+			}
+		}
+		//Leaving on maxFrames ends the app like a quit.
 		quit();
 	}
-};
\ No newline at end of file
+
+	void quit(){ if(!isQuit){ isQuit = true; onAppExit(); } }
+	template<typename F> void post(F&& f){ tasks.push(std::forward<F>(f)); } //Run f on the loop thread, callable from any thread.
+
+	void resize(int w, int h)
+	{
+		if(w != width() || h != height())
+		{
+			renderer.resize(w, h);
+			size.w = w; size.h = h;
+		}
+		onAppResize(w, h, StateChange::Resized);
+	}
+
+	template<typename F> void   exitHandler(F&& f){ onAppExit   = std::forward<F>(f); }
+	template<typename F> void   idleHandler(F&& f){ onAppStep   = std::forward<F>(f); }
+	template<typename F> void renderHandler(F&& f){ onAppRender = std::forward<F>(f); }
+	template<typename F> void resizeHandler(F&& f){ onAppResize = std::forward<F>(f); }
+	template<typename F> void  mouseHandler(F&& f){ input.onMouseEvent = std::forward<F>(f); }
+	template<typename F> void  frameHandler(F&& f){ onAppFrame  = std::forward<F>(f); } //f(Image2D const&, long frame)
+	template<typename F> void  eventSource (F&& f){ onAppEvents = std::forward<F>(f); } //f(HeadlessWindow&, long frame)
+};
+
+//Records finished frames (e.g. attached to a MainWindow or HeadlessWindow) without blocking the render loop on disk
+//I/O: push copies the backbuffer into one of a fixed number of preallocated frames and a background thread writes
+//them out. If all frames are in flight, push either drops the new frame (counted in dropped) or waits for one.
+struct FrameRecorder
+{
+	enum Format{ PPM, Y4M, Raw };  //PPM: concatenated P6 images, Y4M: 4:4:4 YUV4MPEG2 stream, Raw: memory-mapped BGRA frame file
+	enum Policy{ Drop, Block };
+
+	Format format;
+	Policy policy;
+	int w, h, fps;
+	std::vector<Image2D> frames;
+	std::vector<int> idle, ready; //Slot indices, ready is a ring buffer of pending writes.
+	size_t rhead, rcount;
+	std::mutex m;
+	std::condition_variable cv_ready, cv_free;
+	std::thread io;
+	bool stop;
+	std::atomic<long> pushed, written, dropped, failed; //written counts the frames stored in the file, failed the others.
+
+	FILE* file;
+	std::vector<unsigned char> line;
+#ifndef _WIN32
+	int fd;
+#endif
+
+	FrameRecorder():format{PPM}, policy{Drop}, w{0}, h{0}, fps{60}, rhead{0}, rcount{0}, stop{true}, pushed{0}, written{0}, dropped{0}, failed{0}, file{nullptr}
+	{
+#ifndef _WIN32
+		fd = -1;
+#endif
+	}
+	~FrameRecorder(){ close(); }
+
+	FrameRecorder(FrameRecorder const&) = delete;
+	FrameRecorder& operator=(FrameRecorder const&) = delete;
+
+	bool open(std::string const& path, Format format_, int w_, int h_, int n_frames = 8, Policy policy_ = Drop, int fps_ = 60)
+	{
+		close();
+		if(w_ <= 0 || h_ <= 0 || n_frames <= 0){ return false; }
+		format = format_; policy = policy_; w = w_; h = h_; fps = fps_;
+#ifndef _WIN32
+		if(format == Raw)
+		{
+			fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if(fd < 0){ printf("Cannot open recording file %s\n", path.c_str()); return false; }
+		}
+		else
+#endif
+		{
+			file = fopen(path.c_str(), "wb");
+			if(!file){ printf("Cannot open recording file %s\n", path.c_str()); return false; }
+			if(format == Y4M){ fprintf(file, "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C444\n", w, h, fps); }
+		}
+
+		frames.resize(n_frames);
+		idle.resize(n_frames);
+		ready.resize(n_frames);
+		for(int i=0; i<n_frames; ++i){ frames[i].resize(w, h); idle[i] = n_frames - 1 - i; }
+		rhead = rcount = 0;
+		pushed = written = dropped = failed = 0;
+		line.resize((size_t)w * 4);
+		stop = false;
+		io = std::thread([this]{ work(); });
+		return true;
+	}
+
+	//Copies img (cropped or padded to the recording size) and queues it. Returns false if the frame was dropped.
+	bool push(Image2D const& img)
+	{
+		int slot = -1;
+		{
+			std::unique_lock<std::mutex> lk(m);
+			if(stop){ return false; }
+			if(idle.empty())
+			{
+				if(policy == Drop){ dropped += 1; return false; }
+				cv_free.wait(lk, [&]{ return !idle.empty() || stop; });
+				if(stop){ return false; }
+			}
+			slot = idle.back(); idle.pop_back();
+		}
+
+		auto& dst = frames[slot];
+		const int cw = std::min(w, img.w);
+		for(int y=0; y<h; ++y)
+		{
+			if(y < img.h)
+			{
+				memcpy(&dst(0, y), &img(0, y), (size_t)cw * sizeof(Color));
+				if(cw < w){ fill_span(&dst(cw, y), (size_t)(w - cw), Color{0, 0, 0, 255}); }
+			}
+			else{ fill_span(&dst(0, y), (size_t)w, Color{0, 0, 0, 255}); }
+		}
+
+		{
+			std::lock_guard<std::mutex> lk(m);
+			ready[(rhead + rcount) % ready.size()] = slot;
+			rcount += 1;
+		}
+		pushed += 1;
+		cv_ready.notify_one();
+		return true;
+	}
+
+	template<typename W>
+	void attach(W& wnd){ wnd.frameHandler([this](Image2D const& img, long){ push(img); }); }
+
+	//Writes the pending frames and closes the file.
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lk(m);
+			if(stop && !io.joinable()){ return; }
+			stop = true;
+		}
+		cv_ready.notify_all();
+		cv_free.notify_all();
+		if(io.joinable()){ io.join(); }
+		if(file){ fclose(file); file = nullptr; }
+#ifndef _WIN32
+		if(fd >= 0){ ::close(fd); fd = -1; }
+#endif
+	}
+
+	void work()
+	{
+		while(true)
+		{
+			int slot = -1;
+			{
+				std::unique_lock<std::mutex> lk(m);
+				cv_ready.wait(lk, [&]{ return rcount > 0 || stop; });
+				if(rcount == 0){ return; }
+				slot = ready[rhead];
+				rhead = (rhead + 1) % ready.size();
+				rcount -= 1;
+			}
+			if(write_frame(frames[slot])){ written += 1; }
+			else{ failed += 1; }
+			{
+				std::lock_guard<std::mutex> lk(m);
+				idle.push_back(slot);
+			}
+			cv_free.notify_one();
+		}
+	}
+
+	//Whether the frame was stored. Raw frames go to the offset of the frames written so far.
+	bool write_frame(Image2D const& img)
+	{
+		if(format == PPM)
+		{
+			//A frame fails on its own writes, the sticky error flag of the stream would fail every later one.
+			if(fprintf(file, "P6\n%i %i\n255\n", w, h) < 0){ return false; }
+			for(int y=0; y<h; ++y)
+			{
+				for(int x=0; x<w; ++x){ auto c = img(x, y); line[3*x+0] = c.r; line[3*x+1] = c.g; line[3*x+2] = c.b; }
+				if(fwrite(line.data(), 1, (size_t)w * 3, file) != (size_t)w * 3){ return false; }
+			}
+			return true;
+		}
+		else if(format == Y4M)
+		{
+			//BT.601 studio range.
+			if(fprintf(file, "FRAME\n") < 0){ return false; }
+			for(int plane=0; plane<3; ++plane)
+			{
+				for(int y=0; y<h; ++y)
+				{
+					for(int x=0; x<w; ++x)
+					{
+						auto c = img(x, y);
+						int v = 0;
+						if     (plane == 0){ v = (( 66*c.r + 129*c.g +  25*c.b + 128) >> 8) +  16; }
+						else if(plane == 1){ v = ((-38*c.r -  74*c.g + 112*c.b + 128) >> 8) + 128; }
+						else               { v = ((112*c.r -  94*c.g -  18*c.b + 128) >> 8) + 128; }
+						line[x] = (unsigned char)v;
+					}
+					if(fwrite(line.data(), 1, (size_t)w, file) != (size_t)w){ return false; }
+				}
+			}
+			return true;
+		}
+		else
+		{
+			const size_t bytes = (size_t)w * (size_t)h * sizeof(Color);
+			const size_t offset = (size_t)written * bytes;
+#ifndef _WIN32
+			//Grow the file and copy the frame through a mapping of the pages it occupies.
+			const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+			const size_t base = offset / page * page;
+			if(ftruncate(fd, (off_t)(offset + bytes)) != 0){ printf("Cannot grow recording file\n"); return false; }
+			void* p = mmap(nullptr, offset + bytes - base, PROT_WRITE, MAP_SHARED, fd, (off_t)base);
+			if(p == MAP_FAILED){ printf("Cannot map recording file\n"); return false; }
+			memcpy((char*)p + (offset - base), img.data.data(), bytes);
+			munmap(p, offset + bytes - base);
+			return true;
+#else
+			(void)offset;
+			return fwrite(img.data.data(), 1, bytes, file) == bytes;
+#endif
+		}
+	}
+};
@@ -0,0 +1,539 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include "table2d.h"
+#include "life.h"
+
+//Pattern files: RLE and Golly's Macrocell format. Files are read and written through fixed-size blocks, so the
+//memory used does not grow with the size of the file, and RLE runs go to the board as they are decoded.
+//Macrocell files are DAGs of nodes that refer back to earlier ones, they are read into a HashLife.
+
+struct PatternInfo
+{
+	int64_t w, h;          //Size from the RLE header, 0 if there is none.
+	int64_t x, y;          //Top-left cell from an RLE "#CXRLE Pos=x,y" line, used by unbounded boards.
+	Rule rule;
+	uint64_t generation;   //Macrocell #G line.
+
+	PatternInfo():w{0}, h{0}, x{0}, y{0}, rule(Rule::parse("B3/S23")), generation{0}{}
+};
+
+namespace PatternDetails
+{
+	enum : size_t { BlockSize = 1 << 16 };
+
+	struct BlockReader
+	{
+		FILE* f;
+		std::vector<char> buffer;
+		size_t pos, end;
+
+		BlockReader(FILE* f_):f{f_}, buffer(BlockSize), pos{0}, end{0}{}
+
+		//The next byte, -1 at the end of the file.
+		int peek()
+		{
+			if(pos == end)
+			{
+				end = fread(buffer.data(), 1, buffer.size(), f);
+				pos = 0;
+				if(end == 0){ return -1; }
+			}
+			return (unsigned char)buffer[pos];
+		}
+		int get(){ const int c = peek(); if(c >= 0){ pos += 1; } return c; }
+
+		//The rest of the current line without the line break, false at the end of the file.
+		bool line(std::string& s)
+		{
+			s.clear();
+			int c = get();
+			if(c < 0){ return false; }
+			for(; c >= 0 && c != '\n'; c = get()){ if(c != '\r'){ s += (char)c; } }
+			return true;
+		}
+	};
+
+	struct BlockWriter
+	{
+		FILE* f;
+		std::vector<char> buffer;
+		bool ok;
+
+		BlockWriter(FILE* f_):f{f_}, buffer{}, ok{true}{ buffer.reserve(BlockSize); }
+
+		void flush()
+		{
+			if(!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), f) != buffer.size()){ ok = false; }
+			buffer.clear();
+		}
+		void put(char c){ buffer.push_back(c); if(buffer.size() >= BlockSize){ flush(); } }
+		void write(char const* s, size_t n){ buffer.insert(buffer.end(), s, s + n); if(buffer.size() >= BlockSize){ flush(); } }
+		void write(std::string const& s){ write(s.data(), s.size()); }
+	};
+
+	inline std::string trim(std::string const& s)
+	{
+		const auto b = s.find_first_not_of(" \t");
+		if(b == std::string::npos){ return ""; }
+		return s.substr(b, s.find_last_not_of(" \t") - b + 1);
+	}
+}
+
+//RLE: an "x = w, y = h, rule = ..." header after optional # lines, then runs of b (dead) and o (live) cells,
+//$ for the end of a row and ! at the end. Multi-state patterns use . for 0 and A..X, pA..yO for the states 1..255.
+//Golly's "#CXRLE Pos=x,y" line gives the position of the top-left cell.
+struct RleReader
+{
+	PatternDetails::BlockReader in;
+	PatternInfo info;
+
+	RleReader(FILE* f):in{f}, info{}{}
+
+	//Skips the comments and reads the header line, if there is one.
+	bool header()
+	{
+		std::string line;
+		for(int c = in.peek(); c >= 0; c = in.peek())
+		{
+			if(c == ' ' || c == '\t' || c == '\r' || c == '\n'){ in.get(); continue; }
+			if(c == '#')
+			{
+				in.line(line);
+				const auto pos = line.find("Pos=");
+				if(line.compare(0, 6, "#CXRLE") == 0 && pos != std::string::npos)
+				{
+					long long x, y;
+					if(sscanf(line.c_str() + pos + 4, "%lld,%lld", &x, &y) == 2){ info.x = x; info.y = y; }
+				}
+				continue;
+			}
+			if(c != 'x'){ return true; }
+			in.line(line);
+			size_t start = 0;
+			while(start <= line.size())
+			{
+				size_t end = line.find(',', start);
+				if(end == std::string::npos){ end = line.size(); }
+				const std::string field = line.substr(start, end - start);
+				const auto eq = field.find('=');
+				if(eq != std::string::npos)
+				{
+					const std::string key = PatternDetails::trim(field.substr(0, eq)), value = PatternDetails::trim(field.substr(eq + 1));
+					if     (key == "x"){ info.w = strtoll(value.c_str(), nullptr, 10); }
+					else if(key == "y"){ info.h = strtoll(value.c_str(), nullptr, 10); }
+					else if(key == "rule")
+					{
+						//Without a bounded grid suffix like :T100,100.
+						const Rule r = Rule::parse(value.substr(0, value.find(':')).c_str());
+						if(!r.valid){ printf("Unsupported rule %s\n", value.c_str()); return false; }
+						info.rule = r;
+					}
+				}
+				start = end + 1;
+			}
+			return true;
+		}
+		return true;
+	}
+
+	//Calls run(x, y, n, state) on every run of live cells, row y, columns [x, x+n). False on a malformed file.
+	template<typename F>
+	bool cells(F&& run)
+	{
+		int64_t x = 0, y = 0, n = 0;
+		int prefix = 0;
+		std::string skip;
+		for(int c = in.get(); c >= 0; c = in.get())
+		{
+			if(c >= '0' && c <= '9'){ n = n * 10 + (c - '0'); continue; }
+			if(c >= 'p' && c <= 'y'){ prefix = c - 'p' + 1; continue; }
+			const int64_t count = n > 0 ? n : 1;
+			n = 0;
+			int state = -1;
+			if     (c == 'b' || c == '.'){ state = 0; }
+			else if(c == 'o'){ state = 1; }
+			else if(c >= 'A' && c <= 'X'){ state = prefix * 24 + (c - 'A') + 1; }
+			else if(c == '$'){ y += count; x = 0; }
+			else if(c == '!'){ return true; }
+			else if(c == '#'){ in.line(skip); }
+			else if(c != ' ' && c != '\t' && c != '\r' && c != '\n'){ printf("Unexpected '%c' in RLE data\n", (char)c); return false; }
+			prefix = 0;
+			if(state > 255){ printf("RLE state %i out of range\n", state); return false; }
+			if(state > 0){ run(x, y, count, state); }
+			if(state >= 0){ x += count; }
+		}
+		//Some writers leave out the final !.
+		return true;
+	}
+};
+
+//Run-length encodes rows of cells into lines of at most 70 characters. Runs of the same state are merged, dead
+//cells at the end of a row and empty rows before the next live cell are only counted.
+struct RleWriter
+{
+	PatternDetails::BlockWriter out;
+	int states;
+	int run_state;
+	int64_t run, rows;
+	int column;
+
+	//A pattern not at the origin gets a #CXRLE line with its top-left cell (x, y).
+	RleWriter(FILE* f, int64_t w, int64_t h, Rule const& rule, int64_t x = 0, int64_t y = 0):out{f}, states{rule.states}, run_state{0}, run{0}, rows{0}, column{0}
+	{
+		if(x != 0 || y != 0){ out.write("#CXRLE Pos=" + std::to_string(x) + "," + std::to_string(y) + "\n"); }
+		out.write("x = " + std::to_string(w) + ", y = " + std::to_string(h) + ", rule = " + rule.str() + "\n");
+	}
+
+	//A count, left out for 1, and a tag of at most 2 characters.
+	void token(int64_t n, char const* name)
+	{
+		char t[24];
+		int len = 0;
+		if(n > 1)
+		{
+			char digits[20];
+			int d = 0;
+			for(; n > 0; n /= 10){ digits[d++] = (char)('0' + n % 10); }
+			while(d > 0){ t[len++] = digits[--d]; }
+		}
+		for(; *name; ++name){ t[len++] = *name; }
+		if(column + len > 70){ out.put('\n'); column = 0; }
+		out.write(t, len);
+		column += len;
+	}
+
+	void tag(int state, char* s) const
+	{
+		if(states == 2){ s[0] = state ? 'o' : 'b'; s[1] = 0; return; }
+		if(state == 0){ s[0] = '.'; s[1] = 0; return; }
+		if(state > 24){ *s++ = (char)('p' + (state - 1) / 24 - 1); }
+		s[0] = (char)('A' + (state - 1) % 24);
+		s[1] = 0;
+	}
+
+	void emit()
+	{
+		if(run == 0){ return; }
+		if(rows > 0){ token(rows, "$"); rows = 0; }
+		char s[3];
+		tag(run_state, s);
+		token(run, s);
+		run = 0;
+	}
+
+	//n cells of a state in the current row.
+	void cells(int64_t n, int state)
+	{
+		if(n <= 0){ return; }
+		if(state != run_state){ emit(); run_state = state; }
+		run += n;
+	}
+
+	void end_row()
+	{
+		if(run_state != 0){ emit(); }
+		run = 0; run_state = 0;
+		rows += 1;
+	}
+
+	bool finish()
+	{
+		if(run_state != 0){ emit(); }
+		token(1, "!");
+		out.put('\n');
+		out.flush();
+		return out.ok;
+	}
+};
+
+namespace PatternDetails
+{
+	//The cells after the header, with the top-left cell at (x0, y0). Cells outside of the table are dropped, states
+	//the board does not have come in as live, 0 states are those of the rule in the header.
+	inline bool rle_cells(RleReader& r, Table2D<char>& t, int64_t x0, int64_t y0, int states)
+	{
+		if(states <= 0){ states = r.info.rule.states; }
+		return r.cells([&](int64_t x, int64_t y, int64_t n, int state)
+		{
+			const int64_t yy = y0 + y;
+			if(yy < 0 || yy >= t.h){ return; }
+			const int64_t lo = std::max<int64_t>(x0 + x, 0), hi = std::min<int64_t>(x0 + x + n, t.w);
+			if(lo < hi){ std::fill(&t(0, (int)yy) + lo, &t(0, (int)yy) + hi, (char)(state < states ? state : 1)); }
+		});
+	}
+}
+
+//Reads an RLE pattern into t with its top-left cell at (x0, y0), cells outside of the table are dropped.
+//An empty table is sized to the pattern first. Cells in states of at least states, if given, are set live.
+inline bool load_rle(FILE* f, Table2D<char>& t, int x0 = 0, int y0 = 0, PatternInfo* info = nullptr, int states = 0)
+{
+	RleReader r(f);
+	if(!r.header()){ return false; }
+	if(t.size() == 0 && r.info.w > 0 && r.info.h > 0){ t.resize((int)r.info.w, (int)r.info.h); }
+	const bool ok = PatternDetails::rle_cells(r, t, x0, y0, states);
+	if(info){ *info = r.info; }
+	return ok;
+}
+
+//Live cells of two-state patterns into a SparseLife, with the top-left cell at (x0, y0) moved by its #CXRLE position.
+inline bool load_rle(FILE* f, SparseLife& board, int64_t x0 = 0, int64_t y0 = 0, PatternInfo* info = nullptr)
+{
+	RleReader r(f);
+	if(!r.header()){ return false; }
+	x0 += r.info.x; y0 += r.info.y;
+	const bool ok = r.cells([&](int64_t x, int64_t y, int64_t n, int)
+	{
+		for(int64_t i=0; i<n; ++i){ board.set(x0 + x + i, y0 + y, true); }
+	});
+	if(info){ *info = r.info; }
+	return ok;
+}
+
+inline bool save_rle(FILE* f, Table2D<char> const& t, Rule const& rule)
+{
+	RleWriter out(f, t.w, t.h, rule);
+	for(int y=0; y<t.h; ++y)
+	{
+		char const* row = &t(0, y);
+		for(int x=0; x<t.w; )
+		{
+			int e = x + 1;
+			while(e < t.w && row[e] == row[x]){ e += 1; }
+			out.cells(e - x, (unsigned char)row[x]);
+			x = e;
+		}
+		out.end_row();
+	}
+	return out.finish();
+}
+
+//Writes the bounding box of the chunks, a row of chunks at a time, with its position for load_rle.
+inline bool save_rle(FILE* f, SparseLife const& board)
+{
+	const int64_t size = SparseLife::Size;
+	std::map<int32_t, std::vector<SparseLife::Chunk const*>> rows;
+	int64_t cx0 = 0, cx1 = -1;
+	for(auto const& kv : board.index)
+	{
+		auto const& c = board.chunks[kv.second];
+		if(rows.empty() && cx1 < cx0){ cx0 = cx1 = c.cx; }
+		cx0 = std::min<int64_t>(cx0, c.cx);
+		cx1 = std::max<int64_t>(cx1, c.cx);
+		rows[c.cy].push_back(&c);
+	}
+	const int64_t w = rows.empty() ? 0 : (cx1 - cx0 + 1) * size;
+	const int64_t h = rows.empty() ? 0 : ((int64_t)rows.rbegin()->first - rows.begin()->first + 1) * size;
+	int64_t cy = rows.empty() ? 0 : rows.begin()->first;
+	RleWriter out(f, w, h, Rule::parse("B3/S23"), cx0 * size, cy * size);
+	for(auto& r : rows)
+	{
+		std::sort(r.second.begin(), r.second.end(), [](auto a, auto b){ return a->cx < b->cx; });
+		for(; cy < r.first; ++cy){ for(int i=0; i<SparseLife::Size; ++i){ out.end_row(); } }
+		for(int i=0; i<SparseLife::Size; ++i)
+		{
+			//Columns up to x are written.
+			int64_t x = cx0 * size;
+			for(auto c : r.second)
+			{
+				const int64_t left = (int64_t)c->cx * size;
+				for(uint64_t bits = c->cells[i]; bits; )
+				{
+					const int b = LifeDetails::ctz(bits);
+					const uint64_t rest = ~bits >> b;
+					const int e = rest ? b + LifeDetails::ctz(rest) : 64;
+					out.cells(left + b - x, 0);
+					out.cells(e - b, 1);
+					x = left + e;
+					bits = e == 64 ? 0 : bits & (~0ull << e);
+				}
+			}
+			out.end_row();
+		}
+		cy = r.first + 1;
+	}
+	return out.finish();
+}
+
+//Macrocell: a [M2] line, #R rule and #G generation, then one node per line numbered from 1. Level 3 nodes are
+//8 x 8 bitmaps of . and * with $ ending a row, others are "k nw ne sw se" with 0 for the empty node. The last node
+//is the root, centred on the origin.
+inline bool read_macrocell(FILE* f, HashLife& board, PatternInfo* info = nullptr)
+{
+	PatternDetails::BlockReader in(f);
+	PatternInfo pi;
+	std::vector<HashLife::Index> ids(1, 0);
+	std::vector<int> levels(1, 0);
+	std::string line;
+	board.clear();
+	bool first = true;
+	while(in.line(line))
+	{
+		if(first && line.compare(0, 2, "[M") != 0){ printf("Not a Macrocell file\n"); return false; }
+		first = false;
+		if(line.empty() || line[0] == '['){ continue; }
+		if(line[0] == '#')
+		{
+			if(line.size() > 2 && line[1] == 'R')
+			{
+				const Rule r = Rule::parse(PatternDetails::trim(line.substr(2)).c_str());
+				if(!r.valid || r.states != 2){ printf("Unsupported rule %s\n", line.c_str() + 2); return false; }
+				pi.rule = r;
+			}
+			if(line.size() > 2 && line[1] == 'G'){ pi.generation = strtoull(line.c_str() + 2, nullptr, 10); }
+			continue;
+		}
+		if(line[0] == '.' || line[0] == '*' || line[0] == '$')
+		{
+			bool cell[8][8] = {};
+			int x = 0, y = 0;
+			for(char c : line)
+			{
+				if(c == '$'){ y += 1; x = 0; continue; }
+				if(x >= 8 || y >= 8){ printf("Macrocell leaf out of range\n"); return false; }
+				cell[y][x++] = c == '*';
+			}
+			auto quad = [&](int x0, int y0, int k, auto& self)->HashLife::Index
+			{
+				if(k == 0){ return cell[y0][x0] ? 1 : 0; }
+				const int h = 1 << (k - 1);
+				return board.join(self(x0, y0, k-1, self), self(x0 + h, y0, k-1, self), self(x0, y0 + h, k-1, self), self(x0 + h, y0 + h, k-1, self));
+			};
+			ids.push_back(quad(0, 0, 3, quad));
+			levels.push_back(3);
+			continue;
+		}
+		int k = 0;
+		long long q[4] = {0, 0, 0, 0};
+		if(sscanf(line.c_str(), "%d %lld %lld %lld %lld", &k, &q[0], &q[1], &q[2], &q[3]) != 5 || k < 1 || k > 62){ printf("Malformed Macrocell node '%s'\n", line.c_str()); return false; }
+		HashLife::Index c[4];
+		for(int i=0; i<4; ++i)
+		{
+			if(k == 1){ c[i] = q[i] ? 1 : 0; continue; }
+			if(q[i] < 0 || q[i] >= (long long)ids.size() || (q[i] > 0 && levels[q[i]] != k - 1)){ printf("Malformed Macrocell node '%s'\n", line.c_str()); return false; }
+			c[i] = q[i] == 0 ? board.empty(k - 1) : ids[q[i]];
+		}
+		ids.push_back(board.join(c[0], c[1], c[2], c[3]));
+		levels.push_back(k);
+	}
+	if(ids.size() > 1)
+	{
+		board.root = ids.back();
+		while(board.level() < 3){ board.root = board.expand(board.root); }
+	}
+	board.generation = pi.generation;
+	if(info){ *info = pi; }
+	return true;
+}
+
+inline bool write_macrocell(FILE* f, HashLife& board, Rule const& rule = Rule::parse("B3/S23"))
+{
+	PatternDetails::BlockWriter out(f);
+	out.write("[M2] (miniwnd)\n#R " + rule.str() + "\n");
+	if(board.generation){ out.write("#G " + std::to_string(board.generation) + "\n"); }
+	while(board.level() < 3){ board.root = board.expand(board.root); }
+	//File numbers of the nodes written so far, 0 for the empty ones.
+	std::unordered_map<HashLife::Index, uint64_t> numbers;
+	uint64_t next = 1;
+	auto node = [&](HashLife::Index n, auto& self)->uint64_t
+	{
+		auto const& c = board.nodes[n];
+		if(c.population == 0){ return 0; }
+		auto it = numbers.find(n);
+		if(it != numbers.end()){ return it->second; }
+		if(c.level == 3)
+		{
+			std::string s;
+			for(int y=0; y<8; ++y)
+			{
+				std::string row;
+				for(int x=0; x<8; ++x)
+				{
+					HashLife::Index m = n;
+					for(int k=3; k>0; --k){ const int h = 1 << (k - 1); m = board.child(m, ((x & h) ? 1 : 0) + ((y & h) ? 2 : 0)); }
+					row += m ? '*' : '.';
+				}
+				s += row.substr(0, row.find_last_of('*') + 1) + "$";
+			}
+			out.write(s.substr(0, s.find_last_of('*') + 2) + "\n");
+		}
+		else
+		{
+			const uint64_t a = self(c.nw, self), b = self(c.ne, self), d = self(c.sw, self), e = self(c.se, self);
+			out.write(std::to_string(c.level) + " " + std::to_string(a) + " " + std::to_string(b) + " " + std::to_string(d) + " " + std::to_string(e) + "\n");
+		}
+		numbers.emplace(n, next);
+		return next++;
+	};
+	if(node(board.root, node) == 0){ out.write("4 0 0 0 0\n"); }
+	out.flush();
+	return out.ok;
+}
+
+//Live cells of a Macrocell pattern into a table, with the origin of the pattern at (x0, y0). An empty table is
+//sized to the live cells first, with the top-left one at (x0, y0).
+inline bool load_macrocell(FILE* f, Table2D<char>& t, int x0, int y0, PatternInfo* info = nullptr)
+{
+	HashLife h;
+	if(!read_macrocell(f, h, info)){ return false; }
+	int64_t ox = x0, oy = y0;
+	if(t.size() == 0)
+	{
+		int64_t lx = INT64_MAX, ly = INT64_MAX, hx = INT64_MIN, hy = INT64_MIN;
+		h.for_each_live([&](int64_t x, int64_t y){ lx = std::min(lx, x); ly = std::min(ly, y); hx = std::max(hx, x); hy = std::max(hy, y); });
+		if(hx < lx){ return true; }
+		if(hx - lx >= INT32_MAX || hy - ly >= INT32_MAX){ printf("Macrocell pattern too large for a table\n"); return false; }
+		t.resize((int)(hx - lx + 1), (int)(hy - ly + 1));
+		ox -= lx; oy -= ly;
+	}
+	h.for_each_live([&](int64_t x, int64_t y)
+	{
+		x += ox; y += oy;
+		if(x >= 0 && y >= 0 && x < t.w && y < t.h){ t((int)x, (int)y) = 1; }
+	});
+	return true;
+}
+
+inline bool save_macrocell(FILE* f, Table2D<char> const& t, Rule const& rule)
+{
+	if(rule.states != 2){ printf("Macrocell files of %s boards are not supported\n", rule.str().c_str()); return false; }
+	HashLife h;
+	h.build(0, 0, t.w, t.h, [&](int64_t x, int64_t y){ return t((int)x, (int)y) == 1; });
+	return write_macrocell(f, h, rule);
+}
+
+//Reads an RLE or Macrocell file, told apart by the [M2] line, into the middle of t, or an empty t sized to the
+//pattern. Cells in states of at least states, if given, are set live.
+inline bool load_pattern(std::string const& path, Table2D<char>& t, PatternInfo* info = nullptr, int states = 0)
+{
+	FILE* f = fopen(path.c_str(), "rb");
+	if(!f){ printf("Cannot open %s\n", path.c_str()); return false; }
+	const int c = fgetc(f);
+	rewind(f);
+	bool ok;
+	if(c == '['){ ok = load_macrocell(f, t, t.w / 2, t.h / 2, info); }
+	else
+	{
+		RleReader r(f);
+		ok = r.header();
+		if(ok && t.size() == 0 && r.info.w > 0 && r.info.h > 0){ t.resize((int)r.info.w, (int)r.info.h); }
+		ok = ok && PatternDetails::rle_cells(r, t, (t.w - r.info.w) / 2, (t.h - r.info.h) / 2, states);
+		if(info){ *info = r.info; }
+	}
+	fclose(f);
+	return ok;
+}
+
+inline bool save_pattern(std::string const& path, Table2D<char> const& t, Rule const& rule)
+{
+	FILE* f = fopen(path.c_str(), "wb");
+	if(!f){ printf("Cannot open %s for writing\n", path.c_str()); return false; }
+	const bool mc = path.size() > 3 && path.compare(path.size() - 3, 3, ".mc") == 0;
+	bool ok = mc ? save_macrocell(f, t, rule) : save_rle(f, t, rule);
+	ok = (fclose(f) == 0) && ok;
+	if(!ok){ printf("Cannot write %s\n", path.c_str()); }
+	return ok;
+}
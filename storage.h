@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+
+//Default-initialises the elements a vector adds without a value, so a new buffer of trivial elements is left
+//untouched until whoever fills it writes it. With first-touch NUMA placement its pages land near that thread.
+template<typename T>
+struct UninitializedAllocator : std::allocator<T>
+{
+	template<typename U> struct rebind{ using other = UninitializedAllocator<U>; };
+
+	UninitializedAllocator() = default;
+	template<typename U> UninitializedAllocator(UninitializedAllocator<U> const&){}
+
+	template<typename U> void construct(U* p){ ::new((void*)p) U; }
+	template<typename U, typename... A> void construct(U* p, A&&... a){ ::new((void*)p) U(std::forward<A>(a)...); }
+};
+
+//Contiguous storage that either owns its elements or views externally managed memory (e.g. a shared memory segment).
+template<typename T>
+struct Storage
+{
+	std::vector<T, UninitializedAllocator<T>> owned;
+	T* ptr;
+	size_t n;
+
+	Storage():owned{}, ptr{nullptr}, n{0}{}
+	Storage(Storage const& cpy):owned(cpy.begin(), cpy.end()), ptr{owned.data()}, n{cpy.n}{}
+	Storage(Storage&& mv):Storage(){ *this = std::move(mv); }
+	Storage& operator=(Storage const& cpy){ if(this != &cpy){ owned.assign(cpy.begin(), cpy.end()); ptr = owned.data(); n = cpy.n; } return *this; }
+	Storage& operator=(Storage&& mv){ if(this != &mv){ bool ext = mv.attached(); owned = std::move(mv.owned); ptr = ext ? mv.ptr : owned.data(); n = mv.n; mv.ptr = nullptr; mv.n = 0; } return *this; }
+
+	bool attached() const { return ptr != nullptr && ptr != owned.data(); }
+
+	void resize(size_t n_, T const& val = T{})
+	{
+		if(attached()){ owned.assign(ptr, ptr + std::min(n, n_)); }
+		owned.resize(n_, val);
+		ptr = owned.data(); n = n_;
+	}
+
+	//n_ elements left uninitialised in a new buffer, the old contents are dropped. The caller fills them.
+	void allocate(size_t n_)
+	{
+		if(attached() || n_ != n){ owned = decltype(owned){}; owned.resize(n_); }
+		ptr = owned.data(); n = n_;
+	}
+
+	//The caller keeps ownership of p and has to call detach before releasing it.
+	void attach(T* p, size_t n_){ owned.clear(); owned.shrink_to_fit(); ptr = p; n = n_; }
+	void detach(){ if(attached()){ owned.assign(ptr, ptr + n); ptr = owned.data(); } }
+
+	size_t size() const { return n; }
+	T      * data()       { return ptr; }
+	T const* data() const { return ptr; }
+	T      * begin()       { return ptr; }
+	T const* begin() const { return ptr; }
+	T      * end()       { return ptr + n; }
+	T const* end() const { return ptr + n; }
+
+	T      & operator[](size_t i)       { return ptr[i]; }
+	T const& operator[](size_t i) const { return ptr[i]; }
+};
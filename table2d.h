@@ -0,0 +1,313 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include "storage.h"
+#include "threadpool.h"
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//Row-major 2D table, cell (x, y) is data[y*w+x]. The cells may be attached to outside memory, e.g. a mapped Checkpoint.
+template<typename T>
+struct Table2D
+{
+	Storage<T> data;
+	int w, h;
+	int grain; //Rows per chunk in the parallel functions, 0 picks about 16K cells.
+
+	Table2D():data{}, w{0}, h{0}, grain{0}{}
+
+	void resize(int w_, int h_, T const& val_ = (T)0)
+	{
+		data.resize((size_t)w_ * (size_t)h_, val_);
+		w = w_; h = h_;
+	}
+
+	//Resize and set every cell to val on the bands of rows of pool. With first-touch placement each band lands on
+	//the NUMA node of the thread that gets the same rows when the table is later stepped on that pool.
+	void resize(ThreadPool& pool, int w_, int h_, T const& val_ = (T)0)
+	{
+		data.allocate((size_t)w_ * (size_t)h_);
+		w = w_; h = h_;
+		parallel_rows(pool, [&](int lo, int hi){ std::fill(data.data() + (size_t)lo * w, data.data() + (size_t)hi * w, val_); });
+	}
+
+	template<typename F>
+	void fill1(F&& f)
+	{
+		const size_t n = size();
+		for(size_t i=0; i<n; ++i){ data[i] = f(i); }
+	}
+
+	template<typename F>
+	void fill2(F&& f)
+	{
+		for(int j=0; j<h; ++j)
+		{
+			for(int i=0; i<w; ++i)
+			{
+				(*this)(i, j) = f(i, j);
+			}
+		}
+	}
+
+	template<typename F>
+	void parallel_fill2(F&& f){ parallel_fill2(ThreadPool::shared(), f); }
+
+	template<typename F>
+	void parallel_fill2(ThreadPool& pool, F&& f)
+	{
+		parallel_rows(pool, [&](int lo, int hi)
+		{
+			for(int j=lo; j<hi; ++j)
+			{
+				for(int i=0; i<w; ++i)
+				{
+					(*this)(i, j) = f(i, j);
+				}
+			}
+		});
+	}
+
+	//Neighbourhoods passed to stencil kernels, n(dx, dy) is the source cell at offset (dx, dy) from the current one.
+	//Inside the table the offsets are plain pointer arithmetic, only cells within the radius of an edge wrap around.
+	struct Interior
+	{
+		T const* p;
+		ptrdiff_t stride;
+		T const& operator()(int dx, int dy) const { return p[dy*stride + dx]; }
+	};
+
+	struct Wrapped
+	{
+		Table2D const& t;
+		int x, y;
+		T const& operator()(int dx, int dy) const
+		{
+			const int xx = ((x + dx) % t.w + t.w) % t.w;
+			const int yy = ((y + dy) % t.h + t.h) % t.h;
+			return t(xx, yy);
+		}
+	};
+
+	//Set every cell to kernel(n), where n views src around the same cell on a torus and |dx|, |dy| <= R.
+	//The kernel should accept both neighbourhood types, e.g. a generic lambda taking auto const&.
+	template<int R, typename F>
+	void stencil(Table2D const& src, F&& kernel)
+	{
+		if(w != src.w || h != src.h){ resize(src.w, src.h); }
+		stencil<R>(src, kernel, 0, 0, w, h);
+	}
+
+	//Only cells in [x0, x1) x [y0, y1), e.g. a band of rows per thread. The table must have the size of src.
+	template<int R, typename F>
+	void stencil(Table2D const& src, F&& kernel, int x0, int y0, int x1, int y1)
+	{
+		static_assert(R >= 0, "Stencil radius must not be negative");
+		//Columns per block, so that the 2R+1 source rows and the destination row of a block stay in L1.
+		const int block = std::max(64, (int)(32768 / ((2*R + 2) * sizeof(T))));
+		const ptrdiff_t stride = src.w;
+		//The interior columns, the rest of each row wraps around.
+		const int ilo = std::min(std::max(R, x0), x1);
+		const int ihi = std::max(std::min(w - R, x1), ilo);
+		for(int bx=x0; bx<x1; bx+=block)
+		{
+			const int bx1 = std::min(bx + block, x1);
+			for(int y=y0; y<y1; ++y)
+			{
+				T* dst = data.data() + (size_t)y * (size_t)w;
+				if(y < R || y >= h - R)
+				{
+					for(int x=bx; x<bx1; ++x){ dst[x] = kernel(Wrapped{src, x, y}); }
+					continue;
+				}
+				const int lo = std::max(bx, ilo), hi = std::min(bx1, ihi);
+				for(int x=bx; x<std::min(bx1, lo); ++x){ dst[x] = kernel(Wrapped{src, x, y}); }
+				T const* p = src.data.data() + (size_t)y * (size_t)w;
+				for(int x=lo; x<hi; ++x){ dst[x] = kernel(Interior{p + x, stride}); }
+				for(int x=std::max(bx, hi); x<bx1; ++x){ dst[x] = kernel(Wrapped{src, x, y}); }
+			}
+		}
+	}
+
+	template<int R, typename F>
+	void parallel_stencil(Table2D const& src, F&& kernel){ parallel_stencil<R>(ThreadPool::shared(), src, kernel); }
+
+	template<int R, typename F>
+	void parallel_stencil(ThreadPool& pool, Table2D const& src, F&& kernel)
+	{
+		if(w != src.w || h != src.h){ resize(src.w, src.h); }
+		parallel_rows(pool, [&](int lo, int hi){ stencil<R>(src, kernel, 0, lo, w, hi); });
+	}
+
+	//Calls f(lo, hi) on bands of rows on the shared thread pool.
+	template<typename F>
+	void parallel_rows(F&& f)
+	{
+		parallel_rows(ThreadPool::shared(), f);
+	}
+
+	template<typename F>
+	void parallel_rows(ThreadPool& pool, F&& f)
+	{
+		const int rows = grain > 0 ? grain : std::max(1, 16384 / std::max(w, 1));
+		pool.parallel_chunks(h, rows, f);
+	}
+
+	//Cells are counted and indexed in size_t, a mapped checkpoint may hold more than 2^31 of them.
+	size_t size() const { return (size_t)w * (size_t)h; }
+
+	//Point the table at n = w_*h_ cells owned by the caller, who has to detach before releasing them.
+	void attach(T* p, int w_, int h_){ data.attach(p, (size_t)w_ * (size_t)h_); w = w_; h = h_; }
+	void detach(){ data.detach(); }
+
+	T      & operator[](size_t i)       { return data[i]; }
+	T const& operator[](size_t i) const { return data[i]; }
+	T      & operator()(int x, int y)       { return data[(size_t)y*(size_t)w+(size_t)x]; }
+	T const& operator()(int x, int y) const { return data[(size_t)y*(size_t)w+(size_t)x]; }
+};
+
+//Binary board snapshots: a 64 byte header followed by the cells of a Table2D in row-major order, in the byte order
+//of the machine that wrote them. The cells start at a fixed offset, so a loaded file is the board without parsing.
+struct CheckpointHeader
+{
+	char magic[8];        //"T2DBOARD"
+	uint32_t version;
+	uint32_t cellSize;    //sizeof(T)
+	int32_t w, h;
+	uint64_t generation;
+	uint64_t reserved[4];
+
+	static constexpr uint32_t Version = 1;
+	bool valid() const { return std::memcmp(magic, "T2DBOARD", 8) == 0 && version == Version; }
+};
+static_assert(sizeof(CheckpointHeader) == 64, "Checkpoint header must be 64 bytes");
+
+//Write the table and the generation counter to path in one sequential pass. The file is written next to path and
+//renamed over it when complete, so an existing checkpoint (or a mapping of it) is never seen half written.
+template<typename T>
+bool save_checkpoint(std::string const& path, Table2D<T> const& t, uint64_t generation)
+{
+	CheckpointHeader hdr{};
+	std::memcpy(hdr.magic, "T2DBOARD", 8);
+	hdr.version = CheckpointHeader::Version;
+	hdr.cellSize = (uint32_t)sizeof(T);
+	hdr.w = t.w; hdr.h = t.h;
+	hdr.generation = generation;
+
+	const std::string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if(!f){ printf("Cannot open %s for writing\n", tmp.c_str()); return false; }
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+	ok = ok && fwrite(t.data.data(), sizeof(T), t.data.size(), f) == t.data.size();
+	ok = (fclose(f) == 0) && ok;
+	if(!ok){ printf("Cannot write %s\n", tmp.c_str()); std::remove(tmp.c_str()); return false; }
+#ifdef _WIN32
+	if(!MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)){ printf("Cannot replace %s\n", path.c_str()); return false; }
+#else
+	if(std::rename(tmp.c_str(), path.c_str()) != 0){ printf("Cannot replace %s\n", path.c_str()); return false; }
+#endif
+	return true;
+}
+
+//A checkpoint file in memory, boards attach to its cells without copying. On POSIX the file is mapped: Private
+//mappings are copy-on-write, so the board can run on without touching the file; Shared mappings write through
+//to the file and are seen by every process mapping it, sync flushes them. Elsewhere the file is read into memory.
+struct Checkpoint
+{
+	enum Mode{ Private, Shared };
+
+	char* base;
+	size_t bytes;
+	Mode mode;
+	std::vector<char> buffer;   //The file contents where it is not mapped.
+
+	Checkpoint():base{nullptr}, bytes{0}, mode{Private}, buffer{}{}
+	Checkpoint(Checkpoint const&) = delete;
+	Checkpoint& operator=(Checkpoint const&) = delete;
+	~Checkpoint(){ close(); }
+
+	bool is_open() const { return base != nullptr; }
+	CheckpointHeader const& header() const { return *reinterpret_cast<CheckpointHeader const*>(base); }
+	uint64_t generation() const { return header().generation; }
+
+	bool open(std::string const& path, Mode mode_ = Private)
+	{
+		close();
+		mode = mode_;
+#ifdef _WIN32
+		mode = Private;
+		FILE* f = fopen(path.c_str(), "rb");
+		if(!f){ printf("Cannot open %s\n", path.c_str()); return false; }
+		_fseeki64(f, 0, SEEK_END);
+		const long long n = _ftelli64(f);
+		_fseeki64(f, 0, SEEK_SET);
+		buffer.resize(n > 0 ? (size_t)n : 0);
+		const bool ok = n > 0 && fread(buffer.data(), 1, buffer.size(), f) == buffer.size();
+		fclose(f);
+		if(!ok){ printf("Cannot read %s\n", path.c_str()); buffer.clear(); return false; }
+		base = buffer.data();
+		bytes = buffer.size();
+#else
+		const int fd = ::open(path.c_str(), mode == Shared ? O_RDWR : O_RDONLY);
+		if(fd < 0){ printf("Cannot open %s\n", path.c_str()); return false; }
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size <= 0){ printf("Cannot stat %s\n", path.c_str()); ::close(fd); return false; }
+		void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, mode == Shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(p == MAP_FAILED){ printf("Cannot map %s\n", path.c_str()); return false; }
+		base = (char*)p;
+		bytes = (size_t)st.st_size;
+#endif
+		if(bytes < sizeof(CheckpointHeader) || !header().valid() || header().w < 0 || header().h < 0)
+		{
+			printf("%s is not a board checkpoint\n", path.c_str());
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	//Attach t to the cells, they stay valid until close. Fails if the cell type or the file size does not match.
+	template<typename T>
+	bool attach(Table2D<T>& t) const
+	{
+		if(!is_open()){ return false; }
+		auto const& hdr = header();
+		const size_t n = (size_t)hdr.w * (size_t)hdr.h;
+		if(hdr.cellSize != sizeof(T) || bytes < sizeof(CheckpointHeader) + n * sizeof(T)){ printf("Checkpoint does not match the board\n"); return false; }
+		t.attach(reinterpret_cast<T*>(base + sizeof(CheckpointHeader)), hdr.w, hdr.h);
+		return true;
+	}
+
+	//Store the generation of a Shared board in the file and flush it.
+	bool sync(uint64_t generation)
+	{
+		if(!is_open() || mode != Shared){ return false; }
+		reinterpret_cast<CheckpointHeader*>(base)->generation = generation;
+#ifdef _WIN32
+		return false;
+#else
+		return msync(base, bytes, MS_SYNC) == 0;
+#endif
+	}
+
+	//Boards attached to the cells have to detach first.
+	void close()
+	{
+#ifndef _WIN32
+		if(base && buffer.empty()){ munmap(base, bytes); }
+#endif
+		buffer.clear();
+		base = nullptr;
+		bytes = 0;
+	}
+};
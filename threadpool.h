@@ -0,0 +1,309 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#elif defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//NUMA nodes and the CPUs of each, as far as this process may run on them. Read from /sys/devices/system/node on
+//Linux and from the NUMA API on Windows, elsewhere or without NUMA information all CPUs form a single node.
+struct Topology
+{
+	std::vector<std::vector<int>> nodes;
+
+	int cpus() const { int n = 0; for(auto const& c : nodes){ n += (int)c.size(); } return n; }
+
+	//Linux CPU lists like "0-3,8-11".
+	static std::vector<int> parse_cpulist(char const* s)
+	{
+		std::vector<int> cpus;
+		while(*s)
+		{
+			char* e;
+			const long lo = strtol(s, &e, 10);
+			if(e == s){ break; }
+			long hi = lo;
+			if(*e == '-'){ s = e + 1; hi = strtol(s, &e, 10); }
+			for(long c=lo; c<=hi; ++c){ cpus.push_back((int)c); }
+			s = *e == ',' ? e + 1 : e;
+			if(*s == '\n'){ break; }
+		}
+		return cpus;
+	}
+
+	static Topology detect()
+	{
+		Topology t;
+#ifdef _WIN32
+		ULONG highest = 0;
+		if(GetNumaHighestNodeNumber(&highest))
+		{
+			for(ULONG n=0; n<=highest; ++n)
+			{
+				ULONGLONG mask = 0;
+				if(!GetNumaNodeProcessorMask((UCHAR)n, &mask) || mask == 0){ continue; }
+				std::vector<int> cpus;
+				for(int c=0; c<64; ++c){ if((mask >> c) & 1){ cpus.push_back(c); } }
+				t.nodes.push_back(cpus);
+			}
+		}
+#elif defined(__linux__)
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		const bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+		std::vector<std::pair<int, std::vector<int>>> found;
+		if(DIR* d = opendir("/sys/devices/system/node"))
+		{
+			while(dirent* e = readdir(d))
+			{
+				int id;
+				char rest;
+				if(sscanf(e->d_name, "node%d%c", &id, &rest) != 1){ continue; }
+				const std::string path = std::string("/sys/devices/system/node/") + e->d_name + "/cpulist";
+				FILE* f = fopen(path.c_str(), "r");
+				if(!f){ continue; }
+				char line[4096] = {};
+				const bool ok = fgets(line, sizeof(line), f) != nullptr;
+				fclose(f);
+				if(!ok){ continue; }
+				std::vector<int> cpus;
+				for(int c : parse_cpulist(line)){ if(!masked || (c < CPU_SETSIZE && CPU_ISSET(c, &allowed))){ cpus.push_back(c); } }
+				//Nodes with memory only have no CPUs.
+				if(!cpus.empty()){ found.emplace_back(id, cpus); }
+			}
+			closedir(d);
+		}
+		std::sort(found.begin(), found.end());
+		for(auto& n : found){ t.nodes.push_back(n.second); }
+#endif
+		return t.nodes.empty() ? single() : t;
+	}
+
+	//One node with a CPU per hardware thread.
+	static Topology single()
+	{
+		Topology t;
+		t.nodes.emplace_back();
+		for(int c=0; c<(int)std::max(1u, std::thread::hardware_concurrency()); ++c){ t.nodes[0].push_back(c); }
+		return t;
+	}
+
+	static Topology const& system()
+	{
+		static const Topology t = detect();
+		return t;
+	}
+};
+
+//Persistent worker threads. parallel_for blocks the calling thread, which also takes part in the work.
+//The index range is split evenly, every thread takes grain sized chunks from the front of its own part and once
+//that is empty steals half of what is left of another one, so uneven chunks still keep all threads busy.
+//Calls from different threads are serialized, calls from inside a job on the same pool would deadlock.
+//Threads are spread evenly over the NUMA nodes in order, so thread t and with it part t of every range sits on the
+//same node each call. Thieves try the parts of their own node first. Workers can be pinned to their CPU or node,
+//and without stealing every part stays with its thread, which keeps first-touched memory local.
+struct ThreadPool
+{
+	//[lo, hi) of one thread packed into a single word, so the owner and thieves can update it with one CAS.
+	struct alignas(64) Part{ std::atomic<uint64_t> range; };
+
+	enum Pinning{ Unpinned, Cores, Nodes };
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<Part[]> parts;
+	std::mutex m, busy;
+	std::condition_variable cv_start, cv_done;
+	void (*invoke)(void*, int, int);
+	void* job;
+	int grain, active;
+	unsigned long generation;
+	bool stop;
+	bool stealing;                         //Set between calls.
+	Pinning pinning;
+	Topology topology;
+	std::vector<int> cpu_of, node_of;       //By thread.
+	std::vector<std::vector<int>> victims;  //Parts to steal from by thread, the same node first.
+
+	explicit ThreadPool(int n_threads, Pinning pinning_ = Unpinned, Topology const& topology_ = Topology::system())
+		:parts{}, invoke{nullptr}, job{nullptr}, grain{1}, active{0}, generation{0}, stop{false}, stealing{true}, pinning{pinning_}, topology{topology_}
+	{
+		//Threads need CPUs to be placed on.
+		if(topology.cpus() == 0){ topology = Topology::single(); }
+		n_threads = std::max(n_threads, 1);
+		parts.reset(new Part[n_threads]);
+		for(int t=0; t<n_threads; ++t){ parts[t].range = 0; }
+
+		std::vector<std::pair<int, int>> slots;  //CPU and node, node by node.
+		for(int n=0; n<(int)topology.nodes.size(); ++n){ for(int c : topology.nodes[n]){ slots.emplace_back(c, n); } }
+		for(int t=0; t<n_threads; ++t)
+		{
+			auto const& s = slots[(size_t)((long long)t * (long long)slots.size() / n_threads)];
+			cpu_of.push_back(s.first);
+			node_of.push_back(s.second);
+		}
+		victims.resize(n_threads);
+		for(int t=0; t<n_threads; ++t)
+		{
+			for(int v=1; v<n_threads; ++v){ const int o = (t + v) % n_threads; if(node_of[o] == node_of[t]){ victims[t].push_back(o); } }
+			for(int v=1; v<n_threads; ++v){ const int o = (t + v) % n_threads; if(node_of[o] != node_of[t]){ victims[t].push_back(o); } }
+		}
+
+		for(int t=1; t<n_threads; ++t){ workers.emplace_back([this, t]{ pin(t); work(t); }); }
+	}
+
+	~ThreadPool()
+	{
+		{ std::lock_guard<std::mutex> lk(m); stop = true; }
+		cv_start.notify_all();
+		for(auto& t : workers){ t.join(); }
+	}
+
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	//Shared by everything that does not need a pool of its own, one thread per hardware thread.
+	static ThreadPool& shared()
+	{
+		static ThreadPool pool((int)std::max(1u, std::thread::hardware_concurrency()));
+		return pool;
+	}
+
+	int size() const { return (int)workers.size() + 1; }
+
+	//Binds the calling thread to the CPU or the node of thread id, as set by the pinning. Workers pin themselves,
+	//thread 0 is whichever thread calls in and may pin itself with pin(0).
+	bool pin(int id) const
+	{
+		if(pinning == Unpinned || id < 0 || id >= (int)cpu_of.size()){ return false; }
+		const std::vector<int> cpus = pinning == Cores ? std::vector<int>{cpu_of[id]} : topology.nodes[node_of[id]];
+#ifdef _WIN32
+		DWORD_PTR mask = 0;
+		for(int c : cpus){ if(c < (int)sizeof(mask) * 8){ mask |= (DWORD_PTR)1 << c; } }
+		return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(int c : cpus){ if(c < CPU_SETSIZE){ CPU_SET(c, &set); } }
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	//Calls f(i) for every i in [0, n).
+	template<typename F>
+	void parallel_for(int n, F&& f)
+	{
+		auto const& cf = f;
+		parallel_chunks(n, 1, [&](int lo, int hi){ for(int i=lo; i<hi; ++i){ cf(i); } });
+	}
+
+	//Calls f(lo, hi) on chunks covering [0, n), each at most grain_ long except stolen ones being split further.
+	//All threads call the same f at once, so it is called as const: state of its own would race, a mutable lambda
+	//does not compile. Per-thread scratch space goes outside, indexed by chunk or thread.
+	template<typename F>
+	void parallel_chunks(int n, int grain_, F&& f)
+	{
+		auto const& cf = f;
+		if(n <= 0){ return; }
+		grain_ = std::max(grain_, 1);
+		if(n <= grain_ || workers.empty()){ for(int lo=0; lo<n; lo+=grain_){ cf(lo, std::min(lo + grain_, n)); } return; }
+		std::lock_guard<std::mutex> serial(busy);
+		{
+			std::lock_guard<std::mutex> lk(m);
+			invoke = [](void* p, int lo, int hi){ (*(std::remove_reference_t<F> const*)p)(lo, hi); };
+			job = (void*)&cf;
+			grain = grain_;
+			const int k = size();
+			for(int t=0; t<k; ++t){ parts[t].range.store(pack((int)((long long)n * t / k), (int)((long long)n * (t+1) / k)), std::memory_order_relaxed); }
+			active = (int)workers.size();
+			generation += 1;
+		}
+		cv_start.notify_all();
+		run(0);
+		std::unique_lock<std::mutex> lk(m);
+		cv_done.wait(lk, [&]{ return active == 0; });
+	}
+
+	static uint64_t pack(int lo, int hi){ return ((uint64_t)(uint32_t)hi << 32) | (uint32_t)lo; }
+	static int lo_of(uint64_t r){ return (int)(uint32_t)r; }
+	static int hi_of(uint64_t r){ return (int)(uint32_t)(r >> 32); }
+
+	//Owner side: the next chunk from the front.
+	bool take(Part& p, int& lo, int& hi)
+	{
+		auto r = p.range.load(std::memory_order_acquire);
+		while(lo_of(r) < hi_of(r))
+		{
+			const int e = std::min(hi_of(r), lo_of(r) + grain);
+			if(p.range.compare_exchange_weak(r, pack(e, hi_of(r)), std::memory_order_acq_rel)){ lo = lo_of(r); hi = e; return true; }
+		}
+		return false;
+	}
+
+	//Thief side: the back half of what is left.
+	bool steal(Part& p, int& lo, int& hi)
+	{
+		auto r = p.range.load(std::memory_order_acquire);
+		while(lo_of(r) < hi_of(r))
+		{
+			const int mid = lo_of(r) + (hi_of(r) - lo_of(r)) / 2;
+			if(p.range.compare_exchange_weak(r, pack(lo_of(r), mid), std::memory_order_acq_rel)){ lo = mid; hi = hi_of(r); return true; }
+		}
+		return false;
+	}
+
+	void run(int id)
+	{
+		auto& own = parts[id];
+		int lo, hi;
+		while(true)
+		{
+			while(take(own, lo, hi)){ invoke(job, lo, hi); }
+			if(!stealing){ return; }
+			bool stolen = false;
+			for(size_t v=0; v<victims[id].size() && !stolen; ++v){ stolen = steal(parts[victims[id][v]], lo, hi); }
+			if(!stolen){ return; }
+			//Publish the loot as the own part, so it can be stolen again.
+			own.range.store(pack(lo, hi), std::memory_order_release);
+		}
+	}
+
+	void work(int id)
+	{
+		unsigned long seen = 0;
+		while(true)
+		{
+			std::unique_lock<std::mutex> lk(m);
+			cv_start.wait(lk, [&]{ return stop || generation != seen; });
+			if(stop){ return; }
+			seen = generation;
+			lk.unlock();
+			run(id);
+			lk.lock();
+			if(--active == 0){ cv_done.notify_one(); }
+		}
+	}
+};